@@ -0,0 +1,176 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+ 
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+ 
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Inode numbers of merged directories.  See ino.h for the scheme.  */
+
+#define _GNU_SOURCE
+
+#include <hurd/netfs.h>
+#include <stdlib.h>
+
+#include "ino.h"
+#include "unionfs.h"
+
+/* An entry of the table of known filesystems.  */
+struct ino_fsid
+{
+  fsid_t fsid;
+  int index;			/* One more than the index of FSID,
+				   zero for a free slot.  */
+};
+
+/* The table of known filesystems, an open addressing hash table.  */
+static struct ino_fsid *ino_fsid_table;
+static int ino_fsid_size;	/* Always a power of two.  */
+static int ino_fsid_num;
+
+/* An entry of the table for inode numbers, which do not fit into
+   INO_BITS bits.  */
+struct ino_slow
+{
+  int fsid_index;
+  ino_t ino;			/* The underlying inode number.  */
+  ino_t mapped;			/* The reported inode number, zero for
+				   a free slot.  */
+};
+
+static struct ino_slow *ino_slow_table;
+static int ino_slow_size;	/* Always a power of two.  */
+static int ino_slow_num;
+
+/* The last inode number handed out through the slow table.  These
+   are below 1 << INO_BITS and thus never clash with mapped ones.  */
+static ino_t ino_slow_last = UNIONFS_ROOT_INODE;
+
+/* The lock protecting the tables.  */
+static struct mutex ino_lock = MUTEX_INITIALIZER;
+
+/* Return the slot for FSID in the table of size SIZE pointed to by
+   TABLE.  */
+static struct ino_fsid *
+ino_fsid_slot (struct ino_fsid *table, int size, fsid_t fsid)
+{
+  unsigned int slot = (fsid ^ (fsid >> 32)) * 2654435761U;
+
+  for (slot &= size - 1;
+       table[slot].index && table[slot].fsid != fsid;
+       slot = (slot + 1) & (size - 1));
+  return table + slot;
+}
+
+/* Store the index of the filesystem FSID in the table of known
+   filesystems, adding it if needed, in *INDEX.  */
+error_t
+ino_fsid_index (fsid_t fsid, int *index)
+{
+  struct ino_fsid *slot;
+  error_t err = 0;
+
+  mutex_lock (&ino_lock);
+
+  if ((ino_fsid_num + 1) * 2 > ino_fsid_size)
+    {
+      int size = ino_fsid_size ? ino_fsid_size * 2 : 16;
+      struct ino_fsid *table = calloc (size, sizeof (struct ino_fsid));
+      int i;
+
+      if (! table)
+	{
+	  err = ENOMEM;
+	  goto out;
+	}
+      for (i = 0; i < ino_fsid_size; i++)
+	if (ino_fsid_table[i].index)
+	  *ino_fsid_slot (table, size, ino_fsid_table[i].fsid)
+	    = ino_fsid_table[i];
+      free (ino_fsid_table);
+      ino_fsid_table = table;
+      ino_fsid_size = size;
+    }
+
+  slot = ino_fsid_slot (ino_fsid_table, ino_fsid_size, fsid);
+  if (! slot->index)
+    {
+      slot->fsid = fsid;
+      slot->index = ++ino_fsid_num;
+    }
+  *index = slot->index - 1;
+
+ out:
+  mutex_unlock (&ino_lock);
+  return err;
+}
+
+/* Return the slot for FSID_INDEX and INO in the table of size SIZE
+   pointed to by TABLE.  */
+static struct ino_slow *
+ino_slow_slot (struct ino_slow *table, int size, int fsid_index, ino_t ino)
+{
+  unsigned int slot = (ino ^ (ino >> 32) ^ (fsid_index * 2654435761U));
+
+  for (slot &= size - 1;
+       table[slot].mapped && (table[slot].ino != ino
+			      || table[slot].fsid_index != fsid_index);
+       slot = (slot + 1) & (size - 1));
+  return table + slot;
+}
+
+/* Map underlying inode numbers, which do not fit into INO_BITS bits,
+   through the hash table.  */
+error_t
+ino_map_slow (int fsid_index, ino_t ino, ino_t *mapped)
+{
+  struct ino_slow *slot;
+  error_t err = 0;
+
+  mutex_lock (&ino_lock);
+
+  if ((ino_slow_num + 1) * 2 > ino_slow_size)
+    {
+      int size = ino_slow_size ? ino_slow_size * 2 : 256;
+      struct ino_slow *table = calloc (size, sizeof (struct ino_slow));
+      int i;
+
+      if (! table)
+	{
+	  err = ENOMEM;
+	  goto out;
+	}
+      for (i = 0; i < ino_slow_size; i++)
+	if (ino_slow_table[i].mapped)
+	  *ino_slow_slot (table, size, ino_slow_table[i].fsid_index,
+			  ino_slow_table[i].ino) = ino_slow_table[i];
+      free (ino_slow_table);
+      ino_slow_table = table;
+      ino_slow_size = size;
+    }
+
+  slot = ino_slow_slot (ino_slow_table, ino_slow_size, fsid_index, ino);
+  if (! slot->mapped)
+    {
+      slot->fsid_index = fsid_index;
+      slot->ino = ino;
+      slot->mapped = ++ino_slow_last;
+      ino_slow_num++;
+    }
+  *mapped = slot->mapped;
+
+ out:
+  mutex_unlock (&ino_lock);
+  return err;
+}
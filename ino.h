@@ -0,0 +1,64 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+ 
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+ 
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Inode numbers of merged directories.
+
+   Directories merged by unionfs are reported with the fsid of
+   unionfs, so their inode numbers must be unique across all
+   underlying filesystems.  The inode number of a directory is derived
+   from the fsid and inode number of its copy in the first underlying
+   filesystem containing it: the low INO_BITS bits hold the underlying
+   inode number, the high bits the index of the fsid in a table of
+   known filesystems.  This needs no memory per file and is stable for
+   the lifetime of unionfs.  Only the rare underlying inode numbers
+   which do not fit into INO_BITS bits are mapped through a hash
+   table.  */
+
+#ifndef INCLUDED_INO_H
+#define INCLUDED_INO_H
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Number of bits of an underlying inode number kept as is.  */
+#define INO_BITS 40
+
+/* Store the index of the filesystem FSID in the table of known
+   filesystems, adding it if needed, in *INDEX.  */
+error_t ino_fsid_index (fsid_t fsid, int *index);
+
+/* Map underlying inode numbers, which do not fit into INO_BITS bits,
+   through the hash table.  */
+error_t ino_map_slow (int fsid_index, ino_t ino, ino_t *mapped);
+
+/* Store the inode number reported for the file with the inode number
+   INO on the filesystem with the index FSID_INDEX in *MAPPED.  */
+static inline error_t
+ino_map (int fsid_index, ino_t ino, ino_t *mapped)
+{
+  if ((ino >> INO_BITS) == 0
+      && ((ino_t) fsid_index + 1) < ((ino_t) 1 << (64 - INO_BITS)))
+    {
+      *mapped = (((ino_t) fsid_index + 1) << INO_BITS) | ino;
+      return 0;
+    }
+  return ino_map_slow (fsid_index, ino, mapped);
+}
+
+#endif
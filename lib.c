@@ -36,11 +36,9 @@ struct mutex debug_msg_lock = MUTEX_INITIALIZER;
 error_t check_dir (char *path)
 {
   struct stat filestat;
-  error_t err = 0;
 
-  err = stat (path, &filestat);
-  if (err)
-    return err;
+  if (stat (path, &filestat))
+    return errno;
 
   if (!S_ISDIR (filestat.st_mode))
     return ENOTDIR;
@@ -91,6 +89,68 @@ dir_entries_get (file_t dir, char **dirent_data,
   return err;
 }
 
+/* Call FUNC with PRIV for each directory entry of DIR, reading the
+   directory in chunks of at most CHUNK_SIZE bytes, so that only one
+   chunk is held in memory at a time.  Stop as soon as FUNC returns an
+   error and return that error.  */
+error_t
+dir_entries_iterate (file_t dir, size_t chunk_size,
+		     error_t (*func) (struct dirent *, void *), void *priv)
+{
+  error_t err = 0;
+  int entry = 0;
+  int amount;
+  char *buf;
+
+  buf = malloc (chunk_size);
+  if (! buf)
+    return ENOMEM;
+
+  do
+    {
+      mach_msg_type_number_t data_size = chunk_size;
+      char *data = buf;
+      struct dirent *dp;
+      int i;
+
+      /* The reply is stored in BUF, if it fits.  */
+      err = dir_readdir (dir, &data, &data_size, entry, -1, chunk_size,
+			 &amount);
+      if (err)
+	break;
+
+      for (i = 0, dp = (struct dirent *) data;
+	   (! err) && i < amount;
+	   i++, dp = (struct dirent *) ((char *) dp + dp->d_reclen))
+	err = (*func) (dp, priv);
+
+      if (data != buf)
+	munmap (data, data_size);
+      entry += amount;
+    }
+  while ((! err) && amount > 0);
+
+  free (buf);
+  return err;
+}
+
+/* Return a hash value for the string NAME; if LEN is not NULL, store
+   the length of NAME in *LEN.  This is the FNV-1a hash, which is
+   cheap and spreads short file names well.  */
+unsigned int
+name_hash (const char *name, size_t *len)
+{
+  unsigned int hash = 2166136261U;
+  const unsigned char *p;
+
+  for (p = (const unsigned char *) name; *p; p++)
+    hash = (hash ^ *p) * 16777619U;
+
+  if (len)
+    *len = (const char *) p - name;
+  return hash;
+}
+
 /* Lookup the file named NAME beneath DIR (or the cwd, if DIR is not a
    valid port.  Try to open with FLAGS0 first, and if that fails with
    FLAGS1; MODE is the mode to user for newly created files.  On
@@ -157,6 +217,39 @@ make_filepath (char *path, char *filename)
   return filepath;
 }
 
+/* Return non-zero if DIRENT, an entry of the directory PATH, is a
+   directory.  The entry is only stat'ed, following symbolic links, if
+   its type cannot be told from DIRENT itself.  */
+static int
+dirent_is_dir (char *path, struct dirent *dirent)
+{
+  struct stat filestat;
+  char *name;
+  int err;
+
+  if (dirent->d_type == DT_DIR)
+    return 1;
+  if (dirent->d_type != DT_UNKNOWN && dirent->d_type != DT_LNK)
+    return 0;
+
+  name = make_filepath (path, dirent->d_name);
+  if (! name)
+    return 0;
+
+  err = stat (name, &filestat);
+
+  free (name);
+
+  if (err)
+    {
+      fprintf (stderr, "unionfs: couldn't stat %s%s\n",
+	       path, dirent->d_name);
+      return 0;
+    }
+
+  return S_ISDIR (filestat.st_mode);
+}
+
 error_t
 for_each_subdir (char *path, error_t (*func) (char *, char *))
 {
@@ -167,39 +260,28 @@ for_each_subdir (char *path, error_t (*func) (char *, char *))
   error_t err;
 
   dir = file_name_lookup (path, O_READ, 0);
+  if (! port_valid (dir))
+    return errno;
 
   err = dir_entries_get (dir, &dirent_data, &dirent_data_size, &dirent_list);
+  port_dealloc (dir);
   if (err)
     return err;
 
-  for (dirent = dirent_list; (! err) && (*dirent); dirent++)
+  for (dirent = dirent_list; *dirent; dirent++)
     {
-      char *name;
-      struct stat filestat;
-
       if ((!strcmp ((*dirent)->d_name, "."))
 	  || (!strcmp ((*dirent)->d_name, "..")))
 	continue;
 
-      name = make_filepath (path, (*dirent)->d_name);
-
-      err = stat (name, &filestat);
-
-      free (name);
-
-      if (err)
-	{
-	  fprintf (stderr, "unionfs: couldn't stat %s%s\n",
-		   path, (*dirent)->d_name);
-	  continue;
-	}
-
-      if (!S_ISDIR(filestat.st_mode))
+      if (! dirent_is_dir (path, *dirent))
 	continue;
  
       func ((*dirent)->d_name, path);
     }
 
+  munmap (dirent_data, dirent_data_size);
+  free (dirent_list);
   return 0;
 }
 
@@ -214,39 +296,28 @@ for_each_subdir_priv (char *path, error_t (*func) (char *, char *, void *),
   error_t err;
 
   dir = file_name_lookup (path, O_READ, 0);
+  if (! port_valid (dir))
+    return errno;
 
   err = dir_entries_get (dir, &dirent_data, &dirent_data_size, &dirent_list);
+  port_dealloc (dir);
   if (err)
     return err;
 
-  for (dirent = dirent_list; (!err) && (*dirent); dirent++)
+  for (dirent = dirent_list; *dirent; dirent++)
     {
-      char *name;
-      struct stat filestat;
-
       if ((!strcmp ((*dirent)->d_name, "."))
 	  || (!strcmp ((*dirent)->d_name, "..")))
 	continue;
 
-      name = make_filepath (path, (*dirent)->d_name);
-
-      err = stat (name, &filestat);
-
-      free (name);
-
-      if (err)
-	{
-	  fprintf (stderr, "unionfs: couldn't stat %s%s\n",
-		   path, (*dirent)->d_name);
-	  continue;
-	}
-
-      if (!S_ISDIR(filestat.st_mode))
+      if (! dirent_is_dir (path, *dirent))
 	continue;
  
       func ((*dirent)->d_name, path, priv);
     }
 
+  munmap (dirent_data, dirent_data_size);
+  free (dirent_list);
   return 0;
 }
 
@@ -49,6 +49,18 @@ error_t dir_entries_get (file_t dir, char **dirent_data,
 			 size_t *dirent_data_size,
 			 struct dirent ***dirent_list);
 
+/* Call FUNC with PRIV for each directory entry of DIR, reading the
+   directory in chunks of at most CHUNK_SIZE bytes, so that only one
+   chunk is held in memory at a time.  Stop as soon as FUNC returns an
+   error and return that error.  */
+error_t dir_entries_iterate (file_t dir, size_t chunk_size,
+			     error_t (*func) (struct dirent *, void *),
+			     void *priv);
+
+/* Return a hash value for the string NAME; if LEN is not NULL, store
+   the length of NAME in *LEN.  */
+unsigned int name_hash (const char *name, size_t *len);
+
 char *make_filepath (char *, char *);
 error_t for_each_subdir (char *, error_t (*) (char *, char *));
 error_t for_each_subdir_priv (char *, error_t (*) (char *, char *, void *),
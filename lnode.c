@@ -31,6 +31,27 @@
 #include "lib.h"
 #include "unionfs.h"
 
+/* The hash value of the name of NODE, which must not be the root.  */
+#define lnode_hash(node) (name_of ((node)->name)->hash)
+
+/* The locks protecting the entries of the light nodes and the
+   references of those entries, shared by all light nodes whose path
+   hash selects the same lock.  Such a lock is never held while taking
+   another one, so the lock of a light node may be held or not when
+   taking it.  */
+static struct mutex lnode_locks[LNODE_LOCKS] =
+  { [0 ... LNODE_LOCKS - 1] = MUTEX_INITIALIZER };
+
+/* Return the lock protecting the entries of DIR, or the references
+   of the root node if DIR is NULL.  */
+static struct mutex *
+lnode_lock (lnode_t *dir)
+{
+  unsigned int hash = dir ? dir->path_hash : 0;
+
+  return &lnode_locks[(hash ^ hash >> 16) & (LNODE_LOCKS - 1)];
+}
+
 /* Create a new light node as an entry with the name NAME and store it
    in *NODE.  The new node is not locked and contains a single
    reference.  */
@@ -49,22 +70,19 @@ lnode_create (char *name, lnode_t **node)
       char *name_cp = NULL;
 
       if (name)
-	name_cp = strdup (name);
-      if (name && (! name_cp))
-	{
-	  err = ENOMEM;
-	  free (node_new);
-	}
+	err = name_intern (name, &name_cp);
+      if (err)
+	free (node_new);
       else
 	{
 	  node_new->name = name_cp;
-	  node_new->name_len = name_cp ? strlen (name_cp) : 0;
-	  node_new->flags = 0;
+	  node_new->path_hash = 0;
 	  node_new->node = NULL;
 	  node_new->next = NULL;
 	  node_new->prevp = NULL;
 	  node_new->dir = NULL;
 	  node_new->entries = NULL;
+	  node_new->entries_bits = 0;
 	  node_new->references = 1;
 	  mutex_init (&node_new->lock);
 	  mutex_lock (&node_new->lock);
@@ -79,40 +97,130 @@ void
 lnode_destroy (lnode_t *node)
 {
   debug_msg ("lnode_destroy for name: %s", node->name);
-  free (node->name);
+  free (node->entries);
+  if (node->name)
+    name_release (node->name);
   free (node);
 }
 
+/* Rebuild the hash table of the entries of DIR with 2^BITS slots.
+   The lock of the entries of DIR must be held.  */
+static error_t
+lnode_entries_rehash (lnode_t *dir, int bits)
+{
+  lnode_t **entries;
+  lnode_t *n, *next;
+  int i;
+
+  entries = calloc (1 << bits, sizeof (lnode_t *));
+  if (! entries)
+    return ENOMEM;
+
+  for (i = 0; dir->entries && i < 1 << dir->entries_bits; i++)
+    for (n = dir->entries[i]; n; n = next)
+      {
+	lnode_t **bucket = entries + (lnode_hash (n) & ((1 << bits) - 1));
+
+	next = n->next;
+	n->next = *bucket;
+	if (*bucket)
+	  (*bucket)->prevp = &n->next;
+	*bucket = n;
+	n->prevp = bucket;
+      }
+
+  free (dir->entries);
+  dir->entries = entries;
+  dir->entries_bits = bits;
+  return 0;
+}
+
 /* Install the node in the node tree; add a reference to DIR, which
    must be locked.  */
-void
+error_t
 lnode_install (lnode_t *dir, lnode_t *node)
 {
-  lnode_ref_add (dir);
-  node->next = dir->entries;
-  node->prevp = &dir->entries;
-  if (dir->entries)
-    dir->entries->prevp = &node->next;
-  dir->entries = node;
-  node->dir = dir;
+  struct mutex *lock = lnode_lock (dir);
+  lnode_t **bucket, *n;
+  error_t err = 0;
+  int chain = 0;
+
+  mutex_lock (lock);
+
+  if (! dir->entries)
+    err = lnode_entries_rehash (dir, LNODE_ENTRIES_BITS);
+
+  if (! err)
+    {
+      bucket = dir->entries
+	+ (lnode_hash (node) & ((1 << dir->entries_bits) - 1));
+      for (n = *bucket; n; n = n->next)
+	chain++;
+
+      /* The number of entries is not kept; the table grows once
+	 buckets start to fill up.  If it cannot grow, the buckets just
+	 get longer.  */
+      if (chain >= LNODE_ENTRIES_CHAIN
+	  && dir->entries_bits < LNODE_ENTRIES_BITS_MAX
+	  && ! lnode_entries_rehash (dir, dir->entries_bits + 1))
+	bucket = dir->entries
+	  + (lnode_hash (node) & ((1 << dir->entries_bits) - 1));
+
+      node->dir = dir;
+      node->path_hash = (dir->path_hash ^ lnode_hash (node)) * 16777619U;
+      node->next = *bucket;
+      if (*bucket)
+	(*bucket)->prevp = &node->next;
+      *bucket = node;
+      node->prevp = bucket;
+    }
+
+  mutex_unlock (lock);
+
+  if (! err)
+    lnode_ref_add (dir);
+  return err;
 }
 
-/* Uninstall the node from the node tree; remove a reference from the
-   lnode containing NODE.  */
+/* Uninstall the node from the node tree.  The lock of the entries of
+   the lnode containing NODE must be held; the reference NODE holds to
+   it is left to the caller.  */
 void
 lnode_uninstall (lnode_t *node)
 {
-  lnode_ref_remove (node->dir);
   *node->prevp = node->next;
   if (node->next)
-    node->next->prevp = &node->next;
+    node->next->prevp = node->prevp;
 }
 
 /* Add a reference to NODE, which must be locked.  */
 void
 lnode_ref_add (lnode_t *node)
 {
+  struct mutex *lock = lnode_lock (node->dir);
+
+  mutex_lock (lock);
   node->references++;
+  mutex_unlock (lock);
+}
+
+/* Remove a reference from NODE; if that was the last one, uninstall
+   NODE and return non-zero.  NODE is neither locked nor destroyed
+   here.  */
+static int
+lnode_unref (lnode_t *node)
+{
+  struct mutex *lock = lnode_lock (node->dir);
+  int last;
+
+  mutex_lock (lock);
+  assert (node->references);
+  last = ! --node->references;
+  if (last && node->dir)
+    lnode_uninstall (node);
+  mutex_unlock (lock);
+
+  return last;
 }
 
 /* Remove a reference to NODE, which must be locked.  If that was the
@@ -120,14 +228,28 @@ lnode_ref_add (lnode_t *node)
 void
 lnode_ref_remove (lnode_t *node)
 {
-  assert (node->references);
-  if (! --node->references)
+  lnode_t *dir = node->dir;
+
+  if (! lnode_unref (node))
     {
-      lnode_uninstall (node);
+      mutex_unlock (&node->lock);
+      return;
+    }
+
+  /* Nobody can find NODE anymore; see lnode_get.  */
+  mutex_unlock (&node->lock);
+  lnode_destroy (node);
+
+  /* Drop the reference NODE held to DIR.  The caller may have DIR
+     locked, so it is not locked here; references are protected by
+     the lock of the entries only, and the last one is never held by
+     anybody having DIR locked.  */
+  while (dir && lnode_unref (dir))
+    {
+      node = dir;
+      dir = dir->dir;
       lnode_destroy (node);
     }
-  else
-    mutex_unlock (&node->lock);
 }
 
 /* Get a light node by it's name.  The looked up node is locked and
@@ -136,14 +258,29 @@ error_t
 lnode_get (lnode_t *dir, char *name,
 	   lnode_t **node)
 {
+  struct mutex *lock = lnode_lock (dir);
   error_t err = 0;
-  lnode_t *n;
+  unsigned int hash;
+  lnode_t *n = NULL;
+
+  mutex_lock (lock);
+  if (dir->entries)
+    {
+      hash = name_hash (name, NULL);
+      for (n = dir->entries[hash & ((1 << dir->entries_bits) - 1)];
+	   n && (lnode_hash (n) != hash || strcmp (n->name, name));
+	   n = n->next);
+    }
+
+  /* The reference is added before the lock is dropped, so that N
+     cannot go away before it is locked.  */
+  if (n)
+    n->references++;
+  mutex_unlock (lock);
 
-  for (n = dir->entries; n && strcmp (n->name, name); n = n->next);
   if (n)
     {
       mutex_lock (&n->lock);
-      lnode_ref_add (n);
       *node = n;
     }
   else
@@ -163,7 +300,7 @@ lnode_path_construct (lnode_t *node,
   char *p;
 
   for (n = node; n && n->dir; n = n->dir)
-    p_len += n->name_len + (n->dir->dir ? 1 : 0);
+    p_len += name_of (n->name)->len + (n->dir->dir ? 1 : 0);
 
   p = malloc (p_len);
   if (! p)
@@ -173,8 +310,10 @@ lnode_path_construct (lnode_t *node,
       *(p + --p_len) = 0;
       for (n = node; n && n->dir; n = n->dir)
 	{
-	  p_len -= n->name_len;
-	  strncpy (p + p_len, n->name, n->name_len);
+	  int len = name_of (n->name)->len;
+
+	  p_len -= len;
+	  strncpy (p + p_len, n->name, len);
 	  if (n->dir->dir)
 	    *(p + --p_len) = '/';
 	}
@@ -25,21 +25,31 @@
 #include <hurd/netfs.h>
 #include <error.h>
 
+#include "names.h"
+
 struct lnode
 {
-  char *name;			/* The name of this light node.  */
-  int name_len;			/* This is used quite often and since
-				   NAME does not change, just
-				   calculate it once.  */
-  int flags;			/* Associated flags.  */
-  int references;		/* References to this light node.  */
+  char *name;			/* The name of this light node, an
+				   interned string; its length and
+				   hash value are found through
+				   name_of.  */
   struct node *node;	        /* Reference to the real node.  */
-  struct lnode *next, **prevp;	/* Light nodes are connected in a
-				   linked list.  */
+  struct lnode *next, **prevp;	/* Light nodes in the same hash
+				   bucket are connected in a linked
+				   list.  */
   struct lnode *dir;		/* The light node this light node is
 				   contained int.  */
-  struct lnode *entries;	/* A reference to the list containing
-				   the entries of this light node.  */
+  struct lnode **entries;	/* Hash table of the entries of this
+				   light node, or NULL.  Each slot
+				   holds the list of a bucket.  */
+  unsigned int path_hash;	/* Hash value of the path of this
+				   light node, set when installing
+				   it; selects the lock protecting
+				   ENTRIES, the links of the entries
+				   and their references.  */
+  int references;		/* References to this light node.  */
+  unsigned char entries_bits;	/* ENTRIES has 2^ENTRIES_BITS
+				   slots.  */
   struct mutex lock;		/* A lock.  */
 };
 typedef struct lnode lnode_t;
@@ -52,11 +62,13 @@ error_t lnode_create (char *name, lnode_t **node);
 /* Destroy a light node.  */
 void lnode_destroy (lnode_t *node);
 
-/* Install the node in the node tree; add a reference to DIR.  */
-void lnode_install (lnode_t *dir, lnode_t *node);
+/* Install the node in the node tree; add a reference to DIR, which
+   must be locked.  */
+error_t lnode_install (lnode_t *dir, lnode_t *node);
 
-/* Uninstall the node from the node tree; remove a reference from the
-   lnode containing NODE.  */
+/* Uninstall the node from the node tree.  The lock of the entries of
+   the lnode containing NODE must be held; the reference NODE holds to
+   it is left to the caller.  */
 void lnode_uninstall (lnode_t *node);
 
 /* Add a reference to NODE, which must be locked.  */
@@ -36,6 +36,7 @@
 #include "options.h"
 #include "stow.h"
 #include "update.h"
+#include "pool.h"
 
 char *netfs_server_name = "unionfs";
 char *netfs_server_version = HURD_VERSION;
@@ -68,7 +69,9 @@ main (int argc, char **argv)
   mach_port_t bootstrap_port;
   error_t err = 0;
 
-  root_update_init ();
+  err = root_update_init ();
+  if (err)
+    error (EXIT_FAILURE, err, "failed to start update thread");
 
   err = stow_init();
   if (err)
@@ -77,6 +80,10 @@ main (int argc, char **argv)
   /* Argument parsing.  */
   argp_parse (&argp_startup, argc, argv, ARGP_IN_ORDER, 0, 0);
 
+  err = pool_init ();
+  if (err)
+    error (EXIT_FAILURE, err, "failed to start worker threads");
+
   err = node_create_root (&netfs_root_node);
   if (err)
     error (EXIT_FAILURE, err, "failed to create root node");
@@ -96,7 +103,7 @@ main (int argc, char **argv)
     error (EXIT_FAILURE, err, "maptime_map");
 
   /* More initialiazation.  */
-  ncache_init (ncache_size);
+  ncache_init (ncache_size, ncache_memory);
 
   /* Here we adjust the root node permissions.  */
   err = io_stat (underlying_node, &underlying_node_stat);
@@ -106,7 +113,7 @@ main (int argc, char **argv)
 
   fsid = getpid ();
   netfs_root_node->nn_stat = underlying_node_stat;
-  netfs_root_node->nn_stat.st_ino = UNIONFS_ROOT_INODE; /* FIXME.  */
+  netfs_root_node->nn_stat.st_ino = UNIONFS_ROOT_INODE;
   netfs_root_node->nn_stat.st_fsid = fsid;
   netfs_root_node->nn_stat.st_mode = S_IFDIR | (underlying_node_stat.st_mode
 						& ~S_IFMT & ~S_ITRANS);
@@ -0,0 +1,161 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+ 
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+ 
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Interned names.  */
+
+#define _GNU_SOURCE
+
+#include <hurd/netfs.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "names.h"
+#include "lib.h"
+#include "unionfs.h"
+
+/* The interned names are spread over NAMES_SHARDS hash tables by
+   their hash value, each with a lock of its own, so that light nodes
+   can be created and destroyed in parallel.  */
+struct names_shard
+{
+  name_t **table;		/* Each slot holds the list of a
+				   bucket.  */
+  int size;			/* Number of slots in TABLE, always a
+				   power of two.  */
+  int num;			/* Number of names in TABLE.  */
+  struct mutex lock;		/* Protects TABLE, SIZE, NUM and the
+				   references of the names in TABLE.  */
+};
+
+static struct names_shard names_shards[NAMES_SHARDS] =
+  { [0 ... NAMES_SHARDS - 1] = { .lock = MUTEX_INITIALIZER } };
+
+/* Return the shard holding the names with the hash value HASH.  The
+   upper bits are used, as the lower ones select the bucket.  */
+#define names_shard(hash) \
+        (&names_shards[((hash) >> 24) & (NAMES_SHARDS - 1)])
+
+/* Rebuild the hash table of SHARD with SIZE slots, which must be a
+   power of two.  The lock of SHARD must be held.  */
+static error_t
+names_rehash (struct names_shard *shard, int size)
+{
+  name_t **table;
+  name_t *n, *next;
+  int i;
+
+  table = calloc (size, sizeof (name_t *));
+  if (! table)
+    return ENOMEM;
+
+  for (i = 0; i < shard->size; i++)
+    for (n = shard->table[i]; n; n = next)
+      {
+	name_t **bucket = table + (n->hash & (size - 1));
+
+	next = n->next;
+	n->next = *bucket;
+	*bucket = n;
+      }
+
+  free (shard->table);
+  shard->table = table;
+  shard->size = size;
+  return 0;
+}
+
+/* Store the interned copy of STRING in *INTERNED and add a reference
+   to it.  */
+error_t
+name_intern (const char *string, char **interned)
+{
+  struct names_shard *shard;
+  unsigned int hash;
+  size_t len;
+  name_t **bucket, *n;
+  error_t err = 0;
+
+  hash = name_hash (string, &len);
+  shard = names_shard (hash);
+
+  mutex_lock (&shard->lock);
+
+  if (! shard->table)
+    err = names_rehash (shard, NAMES_SIZE / NAMES_SHARDS);
+  else if (shard->num >= shard->size)
+    /* If the table cannot grow, the buckets just get longer.  */
+    names_rehash (shard, shard->size * 2);
+  if (err)
+    {
+      mutex_unlock (&shard->lock);
+      return err;
+    }
+
+  bucket = shard->table + (hash & (shard->size - 1));
+  for (n = *bucket;
+       n && (n->hash != hash || n->len != len
+	     || memcmp (n->string, string, len));
+       n = n->next);
+
+  if (n)
+    n->references++;
+  else
+    {
+      n = malloc (sizeof (name_t) + len + 1);
+      if (! n)
+	err = ENOMEM;
+      else
+	{
+	  n->hash = hash;
+	  n->len = len;
+	  n->references = 1;
+	  memcpy (n->string, string, len + 1);
+	  n->next = *bucket;
+	  *bucket = n;
+	  shard->num++;
+	}
+    }
+
+  mutex_unlock (&shard->lock);
+
+  if (! err)
+    *interned = n->string;
+  return err;
+}
+
+/* Remove a reference from the interned string INTERNED, freeing it if
+   that was the last one.  */
+void
+name_release (char *interned)
+{
+  name_t *name = name_of (interned);
+  struct names_shard *shard = names_shard (name->hash);
+  name_t **n;
+
+  mutex_lock (&shard->lock);
+  if (! --name->references)
+    {
+      for (n = shard->table + (name->hash & (shard->size - 1));
+	   *n != name;
+	   n = &(*n)->next);
+      *n = name->next;
+      shard->num--;
+      free (name);
+    }
+  mutex_unlock (&shard->lock);
+}
@@ -0,0 +1,56 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+ 
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+ 
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Interned names.
+
+   The same few names (`lib', `include', `bin', ...) occur over and
+   over in the tree of light nodes.  Each distinct name is stored only
+   once, together with its hash value and length, and shared by all
+   light nodes carrying it.  */
+
+#ifndef INCLUDED_NAMES_H
+#define INCLUDED_NAMES_H
+
+#include <hurd/netfs.h>
+#include <stddef.h>
+
+/* An interned name.  The string directly follows the structure, so
+   that a pointer to it can be used as an ordinary string.  */
+struct name
+{
+  struct name *next;		/* Names in the same hash bucket.  */
+  unsigned int hash;		/* Hash value of STRING.  */
+  int len;			/* Length of STRING.  */
+  int references;		/* References to this name.  */
+  char string[];
+};
+typedef struct name name_t;
+
+/* Return the name the interned string S belongs to.  */
+#define name_of(s) \
+        ((name_t *) ((char *) (s) - offsetof (name_t, string)))
+
+/* Store the interned copy of STRING in *INTERNED and add a reference
+   to it.  */
+error_t name_intern (const char *string, char **interned);
+
+/* Remove a reference from the interned string INTERNED, freeing it if
+   that was the last one.  */
+void name_release (char *interned);
+
+#endif
@@ -23,6 +23,7 @@
 #include <error.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <sys/param.h>
 
 #include "ncache.h"
 #include "lib.h"
@@ -34,46 +35,257 @@ ncache_t ncache;
 /* Cache size, may be overwritten by the user.  */
 int ncache_size = NCACHE_SIZE;
 
+/* Maximum number of bytes used by the cached nodes, may be
+   overwritten by the user.  */
+size_t ncache_memory = NCACHE_MEMORY;
+
+/* Initialize the ghost list GHOST for at most SIZE_MAX entries.  The
+   list stays disabled, if there is no memory for it.  */
+static void
+ncache_ghost_init (ncache_ghost_t *ghost, int size_max)
+{
+  int buckets = 1, i;
+
+  ghost->oldest = ghost->newest = ghost->free = -1;
+  ghost->num = 0;
+  ghost->entries = NULL;
+  ghost->buckets = NULL;
+
+  if (size_max <= 0)
+    return;
+
+  while (buckets < size_max)
+    buckets *= 2;
+
+  ghost->entries = malloc (size_max * sizeof (ncache_ghost_entry_t));
+  ghost->buckets = malloc (buckets * sizeof (int));
+  if (! ghost->entries || ! ghost->buckets)
+    {
+      free (ghost->entries);
+      free (ghost->buckets);
+      ghost->entries = NULL;
+      ghost->buckets = NULL;
+      return;
+    }
+
+  ghost->buckets_mask = buckets - 1;
+  for (i = 0; i < buckets; i++)
+    ghost->buckets[i] = -1;
+  for (i = size_max - 1; i >= 0; i--)
+    {
+      ghost->entries[i].newer = ghost->free;
+      ghost->free = i;
+    }
+}
+
 /* Initialize the node cache, set the maximum number of allowed nodes
-   in the cache to SIZE_MAX.  */
+   in the cache to SIZE_MAX and the maximum number of bytes used by
+   them to MEMORY_MAX.  */
 void
-ncache_init (int size_max)
+ncache_init (int size_max, size_t memory_max)
 {
-  ncache.mru = NULL;
-  ncache.lru = NULL;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      ncache.hand[i] = NULL;
+      ncache.size[i] = 0;
+      ncache_ghost_init (&ncache.ghost[i], size_max);
+    }
+  ncache.target = 0;
   ncache.size_max = size_max;
   ncache.size_current = 0;
+  ncache.memory_max = memory_max;
+  ncache.memory_current = 0;
   mutex_init (&ncache.lock);
 }
 
-/* Remove the given node NODE from the cache.  */
+/* Insert NODE into the list LIST right behind its hand, so that it
+   is considered last.  */
 static void
-ncache_node_remove (node_t *node)
+ncache_list_insert (node_t *node, int list)
 {
   struct netnode *nn = node->nn;
+  node_t *hand = ncache.hand[list];
 
-  if (nn->ncache_next)
-    nn->ncache_next->nn->ncache_prev = nn->ncache_prev;
-  if (nn->ncache_prev)
-    nn->ncache_prev->nn->ncache_next = nn->ncache_next;
-  if (ncache.mru == node)
-    ncache.mru = nn->ncache_next;
-  if (ncache.lru == node)
-    ncache.lru = nn->ncache_prev;
+  if (hand)
+    {
+      node_t *prev = hand->nn->ncache_prev;
+
+      nn->ncache_next = hand;
+      nn->ncache_prev = prev;
+      prev->nn->ncache_next = node;
+      hand->nn->ncache_prev = node;
+    }
+  else
+    {
+      nn->ncache_next = node;
+      nn->ncache_prev = node;
+      ncache.hand[list] = node;
+    }
+  nn->ncache_list = list;
+  ncache.size[list]++;
+}
+
+/* Remove NODE from the list it is in.  */
+static void
+ncache_list_remove (node_t *node)
+{
+  struct netnode *nn = node->nn;
+  int list = nn->ncache_list;
+
+  if (nn->ncache_next == node)
+    /* It was the only one.  */
+    ncache.hand[list] = NULL;
+  else
+    {
+      nn->ncache_next->nn->ncache_prev = nn->ncache_prev;
+      nn->ncache_prev->nn->ncache_next = nn->ncache_next;
+      if (ncache.hand[list] == node)
+	ncache.hand[list] = nn->ncache_next;
+    }
   nn->ncache_next = NULL;
   nn->ncache_prev = NULL;
+  ncache.size[list]--;
+}
+
+/* Remove the given node NODE from the cache.  */
+static void
+ncache_node_remove (node_t *node)
+{
+  ncache_list_remove (node);
+  ncache.memory_current -= node->nn->ncache_memory;
   ncache.size_current--;
 }
 
-void
-ncache_reset (void)
+/* Return the hash chain of KEY in the ghost list GHOST.  */
+static int *
+ncache_ghost_bucket (ncache_ghost_t *ghost, unsigned int key)
 {
-  node_t *node;
+  return &ghost->buckets[(key ^ (key >> 16)) & ghost->buckets_mask];
+}
 
-  mutex_lock (&ncache.lock);
-  while ((node = ncache.mru))
-    ncache_node_remove (node);
-  mutex_unlock (&ncache.lock);
+/* Return the index of the entry KEY in the ghost list GHOST, or -1 if
+   there is none.  */
+static int
+ncache_ghost_find (ncache_ghost_t *ghost, unsigned int key)
+{
+  int i;
+
+  for (i = *ncache_ghost_bucket (ghost, key);
+       i >= 0 && ghost->entries[i].key != key;
+       i = ghost->entries[i].chain);
+
+  return i;
+}
+
+/* Remove the entry with the index I from the ghost list GHOST.  */
+static void
+ncache_ghost_remove (ncache_ghost_t *ghost, int i)
+{
+  ncache_ghost_entry_t *entry = &ghost->entries[i];
+  int *p;
+
+  for (p = ncache_ghost_bucket (ghost, entry->key);
+       *p != i;
+       p = &ghost->entries[*p].chain);
+  *p = entry->chain;
+
+  if (entry->older >= 0)
+    ghost->entries[entry->older].newer = entry->newer;
+  else
+    ghost->oldest = entry->newer;
+  if (entry->newer >= 0)
+    ghost->entries[entry->newer].older = entry->older;
+  else
+    ghost->newest = entry->older;
+
+  entry->newer = ghost->free;
+  ghost->free = i;
+  ghost->num--;
+}
+
+/* Drop the oldest entry of the ghost list GHOST.  */
+static void
+ncache_ghost_pop (ncache_ghost_t *ghost)
+{
+  ncache_ghost_remove (ghost, ghost->oldest);
+}
+
+/* Append KEY to the ghost list GHOST, dropping the oldest entry if it
+   is full.  */
+static void
+ncache_ghost_push (ncache_ghost_t *ghost, unsigned int key)
+{
+  ncache_ghost_entry_t *entry;
+  int *bucket, i;
+
+  if (! ghost->entries)
+    return;
+
+  if (ghost->free < 0)
+    ncache_ghost_pop (ghost);
+
+  i = ghost->free;
+  entry = &ghost->entries[i];
+  ghost->free = entry->newer;
+
+  entry->key = key;
+  entry->older = ghost->newest;
+  entry->newer = -1;
+  if (ghost->newest >= 0)
+    ghost->entries[ghost->newest].newer = i;
+  else
+    ghost->oldest = i;
+  ghost->newest = i;
+
+  bucket = ncache_ghost_bucket (ghost, key);
+  entry->chain = *bucket;
+  *bucket = i;
+
+  ghost->num++;
+}
+
+/* Evict one node from the cache.  Nodes referenced since the hand of
+   their list passed them get a second chance; referenced nodes of the
+   first list move to the second one.  The first list is evicted from
+   as long as it holds more than TARGET nodes.  */
+static void
+ncache_replace (void)
+{
+  while (1)
+    {
+      int list = ((ncache.size[NCACHE_RECENT]
+		   && (ncache.size[NCACHE_RECENT] >= ncache.target
+		       || ! ncache.size[NCACHE_FREQUENT]))
+		  ? NCACHE_RECENT : NCACHE_FREQUENT);
+      node_t *victim = ncache.hand[list];
+      struct netnode *nn = victim->nn;
+
+      /* The node may have grown or shrunk since it was accounted
+	 for.  */
+      ncache.memory_current += nn->memory - nn->ncache_memory;
+      nn->ncache_memory = nn->memory;
+
+      if (nn->ncache_referenced)
+	{
+	  nn->ncache_referenced = 0;
+	  if (list == NCACHE_RECENT)
+	    {
+	      ncache_list_remove (victim);
+	      ncache_list_insert (victim, NCACHE_FREQUENT);
+	    }
+	  else
+	    ncache.hand[list] = nn->ncache_next;
+	  continue;
+	}
+
+      debug_msg ("removing cached node: %s", nn->lnode->name);
+      ncache_node_remove (victim);
+      ncache_ghost_push (&ncache.ghost[list], nn->lnode->path_hash);
+      netfs_nrele (victim);
+      return;
+    }
 }
 
 /* Lookup the node for the light node LNODE.  If it does not exist
@@ -107,45 +319,101 @@ ncache_node_lookup (lnode_t *lnode, node_t **node)
   return err;
 }
 
-/* Add the given node NODE to the node cache; remove
-   least-recently-used nodes, if needed.  */
+/* Add the given node NODE to the node cache; remove nodes not
+   referenced recently, if needed.  This is a CAR cache (clock with
+   adaptive replacement): a lookup of a cached node only sets its
+   reference bit, which does not need the lock of the cache.  Nodes
+   enter the first list and only move to the second one when looked up
+   again, so a single scan of the tree cannot evict the nodes looked
+   up frequently.  The share of both lists adapts to the workload
+   through the ghost lists of recently evicted nodes.  */
 void
 ncache_node_add (node_t *node)
 {
-  mutex_lock (&ncache.lock);
+  struct netnode *nn = node->nn;
+  unsigned int key = nn->lnode->path_hash;
+  ncache_ghost_t *recent = &ncache.ghost[NCACHE_RECENT];
+  ncache_ghost_t *frequent = &ncache.ghost[NCACHE_FREQUENT];
+  int list = NCACHE_RECENT;
+  int i;
 
-  debug_msg ("adding node to cache: %s", node->nn->lnode->name);
+  /* A cached node is only marked as referenced, without taking the
+     lock of the cache, although other threads change NCACHE_NEXT and
+     NCACHE_REFERENCED under the lock meanwhile.  Both are aligned
+     words, which are read and written atomically, and the node cannot
+     be freed, as the caller holds a reference to it.  The race is
+     benign:
 
-  if (ncache.size_max > 0 || ncache.size_current > 0)
+     - If the node is being evicted right now, it may still look
+       cached; marking it has no effect then, and it is just added
+       again by the next lookup.
+     - If it is being added right now, it may not look cached yet; the
+       lock is taken and NCACHE_NEXT checked again below.
+     - If the hand clears the mark at the same time, the lookup is
+       lost and the node treated as not looked up since the hand
+       passed it last.  That only changes which node is evicted, never
+       the consistency of the lists.  */
+  if (nn->ncache_next)
     {
-      if (ncache.mru != node)
-	{
-	  if (node->nn->ncache_next || node->nn->ncache_prev)
-	    /* Node is already in the cache.  */
-	    ncache_node_remove (node);
-	  else
-	    /* Add a reference from the cache.  */
-	    netfs_nref (node);
-	  
-	  node->nn->ncache_next = ncache.mru;
-	  node->nn->ncache_prev = NULL;
-	  if (ncache.mru)
-	    ncache.mru->nn->ncache_prev = node;
-	  if (! ncache.lru)
-	    ncache.lru = node;
-	  ncache.mru = node;
-	  ncache.size_current++;
-	}
+      nn->ncache_referenced = 1;
+      return;
     }
 
-  /* Forget the least used nodes.  */
-  while (ncache.size_current > ncache.size_max)
+  if (ncache.size_max <= 0)
+    return;
+
+  mutex_lock (&ncache.lock);
+
+  if (nn->ncache_next)
+    {
+      /* Added by another thread meanwhile.  */
+      nn->ncache_referenced = 1;
+      mutex_unlock (&ncache.lock);
+      return;
+    }
+
+  debug_msg ("adding node to cache: %s", nn->lnode->name);
+
+  /* Make room for the node.  */
+  while (ncache.size_current
+	 && (ncache.size_current >= ncache.size_max
+	     || (ncache.memory_max
+		 && ncache.memory_current + nn->memory > ncache.memory_max)))
+    ncache_replace ();
+
+  if (recent->entries && (i = ncache_ghost_find (recent, key)) >= 0)
+    {
+      /* Evicted from the first list too early; let it grow.  */
+      ncache.target += MAX (1, frequent->num / recent->num);
+      if (ncache.target > ncache.size_max)
+	ncache.target = ncache.size_max;
+      ncache_ghost_remove (recent, i);
+      list = NCACHE_FREQUENT;
+    }
+  else if (frequent->entries && (i = ncache_ghost_find (frequent, key)) >= 0)
     {
-      struct node *lru = ncache.lru;
-      debug_msg ("removing cached node: %s", lru->nn->lnode->name);
-      ncache_node_remove (lru);
-      netfs_nrele (lru);
+      /* Evicted from the second list too early; let it grow.  */
+      ncache.target -= MAX (1, recent->num / frequent->num);
+      if (ncache.target < 0)
+	ncache.target = 0;
+      ncache_ghost_remove (frequent, i);
+      list = NCACHE_FREQUENT;
     }
 
+  /* Bound the history to the size of the cache.  */
+  while (recent->num
+	 && ncache.size[NCACHE_RECENT] + recent->num >= ncache.size_max)
+    ncache_ghost_pop (recent);
+  while (frequent->num && recent->num + frequent->num >= ncache.size_max)
+    ncache_ghost_pop (frequent);
+
+  /* Add a reference from the cache.  */
+  netfs_nref (node);
+  nn->ncache_referenced = 0;
+  nn->ncache_memory = nn->memory;
+  ncache_list_insert (node, list);
+  ncache.size_current++;
+  ncache.memory_current += nn->ncache_memory;
+
   mutex_unlock (&ncache.lock);
 }
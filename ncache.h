@@ -25,35 +25,83 @@
 
 #include "node.h"
 
+/* The lists of the cache.  Nodes looked up once since entering the
+   cache are kept in the first, nodes looked up again in the second
+   one.  */
+#define NCACHE_RECENT   0
+#define NCACHE_FREQUENT 1
+
+/* An entry of a ghost list.  Entries are linked by their indices,
+   -1 standing for none.  */
+typedef struct ncache_ghost_entry
+{
+  unsigned int key;		/* Hash value of the path.  */
+  int older, newer;		/* Neighbours in the order of
+				   eviction.  */
+  int chain;			/* Next entry in the same hash
+				   bucket.  */
+} ncache_ghost_entry_t;
+
+/* A list of nodes recently evicted from the cache, identified by the
+   hash values of their paths, oldest first.  The keys are indexed by
+   a hash table, so that entries are found and removed in constant
+   time.  */
+typedef struct ncache_ghost
+{
+  ncache_ghost_entry_t *entries; /* SIZE_MAX entries.  */
+  int *buckets;			/* Heads of the hash chains.  */
+  int buckets_mask;		/* Number of buckets minus one, which
+				   is a power of two.  */
+  int oldest, newest;		/* Both ends of the list.  */
+  int free;			/* Unused entries, linked through
+				   NEWER.  */
+  int num;			/* Number of entries.  */
+} ncache_ghost_t;
+
 typedef struct ncache
 {
-  node_t *mru; 		        /* Reference to the mru end of the
-				   cache chain.  */
-  node_t *lru;		        /* Reference to the lru end of the
-				   cache chain.  */
+  node_t *hand[2];		/* The clock hands of both lists,
+				   pointing to the next node to
+				   consider for eviction; the nodes of
+				   each list form a ring.  */
+  int size[2];			/* Number of nodes in each list.  */
+  ncache_ghost_t ghost[2];	/* Nodes recently evicted from each
+				   list.  */
+  int target;			/* The number of nodes the first list
+				   is allowed to hold, adapted to the
+				   workload.  */
   int size_max;			/* Maximal number of nodes to
 				   cache.  */
   int size_current;		/* Current number of nodes in the
 				   cache.  */
-  struct mutex lock;		/* A lock.  */
+  size_t memory_max;		/* Maximal number of bytes used by the
+				   cached nodes, zero for no
+				   limit.  */
+  size_t memory_current;	/* Number of bytes used by the cached
+				   nodes, as last accounted for.  */
+  struct mutex lock;		/* A lock, not needed for marking a
+				   cached node as referenced.  */
 } ncache_t;
 
 /* Cache size, may be overwritten by the user.  */
 extern int ncache_size;
 
+/* Maximum number of bytes used by the cached nodes, may be
+   overwritten by the user.  */
+extern size_t ncache_memory;
+
 /* Initialize the node cache, set the maximum number of allowed nodes
-   in the cache to SIZE_MAX.  */
-void ncache_init (int size_max);
+   in the cache to SIZE_MAX and the maximum number of bytes used by
+   them to MEMORY_MAX.  */
+void ncache_init (int size_max, size_t memory_max);
 
 /* Lookup the node for the light node LNODE.  If it does not exist
    anymore in the cache, create a new node.  Store the looked up node
    in *NODE.  */
 error_t ncache_node_lookup (lnode_t *lnode, node_t **node);
 
-void ncache_reset (void);
-
-/* Add the given node NODE to the node cache; remove
-   least-recently-used nodes, if needed.  */
+/* Add the given node NODE to the node cache; remove nodes not
+   referenced recently, if needed.  */
 void ncache_node_add (node_t *node);
 
 #endif
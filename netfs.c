@@ -37,6 +37,7 @@
 #include "lib.h"
 #include "ncache.h"
 #include "options.h"
+#include "ino.h"
 
 /* Return an argz string describing the current options.  Fill *ARGZ
    with a pointer to newly malloced storage holding the list and *LEN
@@ -87,56 +88,65 @@ netfs_append_args (char **argz, size_t *argz_len)
 #define OFFSET_T __off64_t		/* Size in bytes.  */
 #endif
 
+/* Store the size of the merged directory DIR, which must be locked,
+   in *OFF.  This is the size of the dirent records of all its
+   entries, which is known as soon as the merged listing has been
+   read; the listing cached in DIR is only read again when the
+   underlying directories have changed.  */
 static error_t
 _get_node_size (struct node *dir, OFFSET_T *off)
 {
-  size_t size = 0;
+  node_dirents_t *dirents;
   error_t err;
-  int count = 0;
-  node_dirent_t *dirent_start, *dirent_current;
-  node_dirent_t *dirent_list = NULL;
-  int first_entry = 2;
-  
-  int bump_size (const char *name)
-    {
-      size_t new_size = size + DIRENT_LEN (strlen (name));
-      
-      size = new_size;
-      count ++;
-      return 1;
-    }
-  
-  err = node_entries_get (dir, &dirent_list);
+
+  err = node_entries_get (dir, &dirents);
   if (err)
     return err;
-  
-  for (dirent_start = dirent_list, count = 2;
-       dirent_start && first_entry > count;
-       dirent_start = dirent_start->next, count++);
-  
-  count = 0;
-  
-  /* Make space for the `.' and `..' entries.  */
-  if (first_entry == 0)
-    bump_size (".");
-  if (first_entry <= 1)
-    bump_size ("..");
-  
-  /* See how much space we need for the result.  */
-  for (dirent_current = dirent_start;
-       dirent_current;
-       dirent_current = dirent_current->next)
-    if (! bump_size (dirent_current->dirent->d_name))
-      break;
-
-  free (dirent_list);
 
-  *off = size;
+  *off = dirents->data_size;
 
   return 0;
 }
 
 
+/* Store the inode number of the parent of DIR, which must be locked
+   and must not be the root node, in *INO.  The parent is stat'ed as
+   it would be when looked up, so that its inode number is mapped the
+   same way.  DIR is unlocked meanwhile, as its parent must be locked
+   first.  */
+static error_t
+_get_dir_ino (struct node *dir, ino_t *ino)
+{
+  lnode_t *dir_lnode = dir->nn->lnode->dir;
+  struct node *np;
+  error_t err;
+
+  if (! dir_lnode->dir)
+    {
+      *ino = netfs_root_node->nn_stat.st_ino;
+      return 0;
+    }
+
+  /* The light node of the parent is kept alive by the one of DIR,
+     which is referenced by DIR.  */
+  mutex_unlock (&dir->lock);
+  mutex_lock (&dir_lnode->lock);
+  err = ncache_node_lookup (dir_lnode, &np);
+  mutex_unlock (&dir_lnode->lock);
+
+  if (! err)
+    {
+      err = netfs_validate_stat (np, NULL);
+      if (! err)
+	*ino = np->nn_stat.st_ino;
+      netfs_nput (np);
+    }
+
+  mutex_lock (&dir->lock);
+  return err;
+}
+
+
 /* Make sure that NP->nn_stat is filled with current information.
    CRED identifies the user responsible for the operation. */
 error_t
@@ -156,12 +166,36 @@ netfs_validate_stat (struct node *np, struct iouser *cred)
 	    if ((! done) && port_valid (node_ulfs->port))
 	      {
 		err = io_stat (node_ulfs->port, &np->nn_stat);
+
+		/* The index of the fsid is remembered in the node, so
+		   that stat'ing it again needs no global lock.  */
+		if (! err
+		    && (np->nn->ino_fsid_index < 0
+			|| np->nn->ino_fsid != np->nn_stat.st_fsid))
+		  {
+		    np->nn->ino_fsid_index = -1;
+		    err = ino_fsid_index (np->nn_stat.st_fsid,
+					  &np->nn->ino_fsid_index);
+		    np->nn->ino_fsid = np->nn_stat.st_fsid;
+		  }
 		if (! err)
-		  np->nn_translated = np->nn_stat.st_mode;
+		  err = ino_map (np->nn->ino_fsid_index, np->nn_stat.st_ino,
+				 &np->nn_stat.st_ino);
+		if (! err)
+		  {
+		    np->nn_stat.st_fsid = fsid;
+		    np->nn_translated = np->nn_stat.st_mode;
+		  }
 		done = 1;
 	      }
 	  if (! done)
 	    err = ENOENT;	/* FIXME?  */
+
+	  /* Directories other than the root report the size of the
+	     topmost underlying directory, whether their merged listing
+	     is cached or not, so that the size does not depend on what
+	     has been read before; merging each directory just to stat
+	     it would cost far more.  */
 	}
     }
   else 
@@ -285,37 +319,17 @@ netfs_attempt_sync (struct iouser *cred, struct node *np,
 {
   error_t err = 0;
 
-  /* The index of the currently analyzed filesystem.  */
-  int i = 0;
-
-  /* The information about the currently analyzed filesystem.  */
-  ulfs_t * ulfs;
-
-  mutex_lock (&ulfs_lock);
-
-  /* Sync every writable directory associated with `np`.
-
-     TODO: Rewrite this after having modified ulfs.c and node.c to
-     store the paths and ports to the underlying directories in one
-     place, because now iterating over both lists looks ugly.  */
+  /* Sync every writable directory associated with `np`.  */
   node_ulfs_iterate_unlocked (np)
   {
-    /* Get the information about the current filesystem.  */
-    err = ulfs_get_num (i, &ulfs);
-    if (err)
-      break;
-
-    if (ulfs->flags & FLAG_ULFS_WRITABLE)
+    if (node_ulfs->flags & FLAG_NODE_ULFS_WRITABLE)
       {
 	err = file_sync (node_ulfs->port, wait, 0);
 	if (err)
 	  break;
       }
-
-    ++i;
   }
 
-  mutex_unlock (&ulfs_lock);
   return err;
 }
 
@@ -362,6 +376,7 @@ netfs_attempt_unlink (struct iouser *user, struct node *dir,
       return err;
 
   err = node_unlink_file (dir, name);
+  node_entries_invalidate (dir);
 
   return err;
 }
@@ -400,6 +415,7 @@ netfs_attempt_mkdir (struct iouser *user, struct node *dir,
     }
 
   err = node_dir_create (dir, name, mode);
+  node_entries_invalidate (dir);
   if (err)
     goto exit;
 
@@ -448,6 +464,7 @@ netfs_attempt_rmdir (struct iouser *user,
       return err;
 
   err = node_dir_remove (dir, name);
+  node_entries_invalidate (dir);
 
   return err;
 }
@@ -494,6 +511,8 @@ netfs_attempt_create_file_reduced (struct iouser *user, struct node *dir,
   mach_port_t p;
   error_t err;
   struct stat statbuf;
+  node_ports_t *ports;
+  int layer = 0;
 
   node_update (dir);
 
@@ -507,11 +526,18 @@ netfs_attempt_create_file_reduced (struct iouser *user, struct node *dir,
       err = EACCES;
       goto exit;
     }
-  
+
+  /* The ports of DIR may be replaced while it is unlocked.  */
+  err = node_ports_make (dir, &ports);
+  if (err)
+    goto exit;
+
   mutex_unlock (&dir->lock);
-  err = node_lookup_file (dir, name, flags | O_CREAT, 
-			  &p, &statbuf);
+  err = node_lookup_file_layer (ports, name, flags | O_CREAT,
+				&layer, &p, &statbuf);
+  node_ports_release (ports);
   mutex_lock (&dir->lock);
+  node_entries_invalidate (dir);
 
   if (err)
     goto exit;
@@ -634,6 +660,40 @@ netfs_node_norefs (struct node *np)
   node_destroy (np);
 }
 
+/* Store the node of the directory NAME beneath DIR_LNODE, which must
+   be locked, in *NODE, creating its light node if needed.  The node is
+   locked and got one reference added.  */
+static error_t
+_get_dir_node (lnode_t *dir_lnode, char *name, node_t **node)
+{
+  lnode_t *lnode;
+  error_t err;
+
+  err = lnode_get (dir_lnode, name, &lnode);
+  if (err == ENOENT)
+    {
+      /* It does not exist, we have to create it.  */
+      err = lnode_create (name, &lnode);
+      if (err)
+	return err;
+
+      err = lnode_install (dir_lnode, lnode);
+      if (err)
+	{
+	  lnode_destroy (lnode);
+	  return err;
+	}
+    }
+
+  /* Now we have a light node.  */
+  err = ncache_node_lookup (lnode, node);
+
+  /* This unlocks the node for us.  */
+  lnode_ref_remove (lnode);
+
+  return err;
+}
+
 error_t
 netfs_attempt_lookup_improved (struct iouser *user, struct node *dir,
 			       char *name, struct node **np,
@@ -641,6 +701,7 @@ netfs_attempt_lookup_improved (struct iouser *user, struct node *dir,
 			       mach_port_t *port,
 			       mach_msg_type_name_t *port_type)
 {
+  node_t *unused = NULL;
   mach_port_t p;
   error_t err;
 
@@ -678,57 +739,107 @@ netfs_attempt_lookup_improved (struct iouser *user, struct node *dir,
 
       lnode_t *dir_lnode = dir->nn->lnode;
       struct stat statbuf;
-      lnode_t *lnode = NULL;
+      node_ports_t *ports;
+      node_t *node;
+      int layer, gen;
 
       /* Lookup the node by it's name on the underlying
 	 filesystems.  */
 
+      /* The ports of DIR may be looked up beneath its parent, whose
+	 light node is locked before DIR's.  */
+      mutex_unlock (&dir_lnode->lock);
       err = node_update (dir);
+      mutex_lock (&dir_lnode->lock);
+
+      /* Names known not to exist are not looked up again, others are
+	 looked up on the filesystem known to contain them first.  */
+      err = node_lookup_cached (dir, name, &layer, &gen);
+      if (err)
+	goto exit;
+
+      if (! lastcomp)
+	{
+	  /* Components before the last one must be directories.  Their
+	     ports are looked up beneath the ones of DIR in a single pass,
+	     which also tells whether they exist, and not at all while
+	     they are still fresh.  DIR is unlocked meanwhile.  */
+	  err = _get_dir_node (dir_lnode, name, &node);
+	  if (err)
+	    goto exit;
+	  node->nn->dir_ino = dir->nn_stat.st_ino;
+
+	  if (! node_update_fresh (node))
+	    {
+	      err = node_update_under (node, dir, &statbuf);
+	      if (! err && ! S_ISDIR (statbuf.st_mode))
+		err = ENOTDIR;
+	      if (err == ENOENT)
+		node_lookup_cache_enter (dir, name, gen, err, 0);
+	      if (err)
+		{
+		  /* Released once DIR is unlocked, as it might go
+		     away.  */
+		  mutex_unlock (&node->lock);
+		  unused = node;
+		  goto exit;
+		}
+	    }
+
+	  *np = node;
+	  goto exit;
+	}
+
+      /* We have to unlock this node while doing lookups; its ports
+	 may be replaced meanwhile, so a snapshot of them is used.  */
+      err = node_ports_make (dir, &ports);
+      if (err)
+	goto exit;
 
-      /* We have to unlock this node while doing lookups.  */
       mutex_unlock (&dir_lnode->lock);
       mutex_unlock (&dir->lock);
 
-      err = node_lookup_file (dir, name, flags & ~(O_NOLINK|O_CREAT),
-			      &p, &statbuf);
+      err = node_lookup_file_layer (ports, name,
+				    flags & ~(O_NOLINK|O_CREAT),
+				    &layer, &p, &statbuf);
+      node_ports_release (ports);
 
       mutex_lock (&dir->lock);
       mutex_lock (&dir_lnode->lock);
 
+      node_lookup_cache_enter (dir, name, gen, err, layer);
 
       if (err)
 	goto exit;
 
       if (S_ISDIR (statbuf.st_mode))
 	{
-	  node_t *node;
-
 	  /* We don't need this port directly.  */
 	  port_dealloc (p);
 	  
 	  /* The found node is a directory, so we have to manage the
-	     node.  First we need the light node.  */
+	     node.  */
+	  err = _get_dir_node (dir_lnode, name, &node);
+	  if (err)
+	      goto exit;
+	  node->nn->dir_ino = dir->nn_stat.st_ino;
 
-	  err = lnode_get (dir_lnode, name, &lnode);
-	  if (err == ENOENT)
+	  /* Its ports are found beneath the ones of DIR, which is
+	     unlocked meanwhile.  The name may have gone away since it
+	     was looked up above.  */
+	  if (! node_update_fresh (node))
 	    {
-	      /* It does not exist, we have to create it.  */
-	      err = lnode_create (name, &lnode);
+	      err = node_update_under (node, dir, &statbuf);
+	      if (err == ENOENT)
+		node_lookup_cache_enter (dir, name, gen, err, 0);
 	      if (err)
-		goto exit;
-	      
-	      lnode_install (dir_lnode, lnode);
+		{
+		  mutex_unlock (&node->lock);
+		  unused = node;
+		  goto exit;
+		}
 	    }
 	  
-	  /* Now we have a light node.  */
-	  err = ncache_node_lookup (lnode, &node);
-	  
-	  /* This unlocks the node for us.  */
-	  lnode_ref_remove (lnode);
-
-	  if (err)
-	      goto exit;
-	  
 	  /* Got the node.  */
 	  *np = node;
 	  
@@ -788,6 +899,10 @@ netfs_attempt_lookup_improved (struct iouser *user, struct node *dir,
 
   mutex_unlock (&dir->nn->lnode->lock);
   mutex_unlock (&dir->lock);
+
+  if (unused)
+    netfs_nrele (unused);
+
   return err;
 }
 
@@ -1097,109 +1212,138 @@ netfs_get_dirents (struct iouser *cred, struct node *dir,
 		   mach_msg_type_number_t *data_len,
 		   vm_size_t max_data_len, int *data_entries)
 {
-  node_dirent_t *dirent_start, *dirent_current;
-  node_dirent_t *dirent_list = NULL;
+  node_dirents_t *dirents;
+  int dots[2], dots_num = 0;
+  int start, end, i;
   size_t size = 0;
   int count = 0;
   char *data_p;
   error_t err;
 
-  int bump_size (const char *name)
+  /* Return the offset of the record of the entry I in the arena of
+     DIRENTS.  */
+  size_t entry_offset (int i)
     {
-      if (num_entries == -1 || count < num_entries)
-	{
-	  size_t new_size = size + DIRENT_LEN (strlen (name));
+      return (i < dirents->num
+	      ? dirents->entries[i].offset : dirents->data_size);
+    }
 
-	  if (max_data_len > 0 && new_size > max_data_len)
-	    return 0;
-	  size = new_size;
-	  count++;
-	  return 1;
-	}
-      else
-	return 0;
+  /* Return non-zero, if another entry of size SZ fits into the
+     result.  */
+  int fits (size_t sz)
+    {
+      return ((num_entries == -1 || count < num_entries)
+	      && (max_data_len == 0 || size + sz <= max_data_len));
     }
 
-  int add_dirent (const char *name, ino_t fileno, int type)
+  /* The inode number of the parent is not known for directories
+     only reached through `..' so far.  */
+  if (first_entry < 2 && dir != netfs_root_node && ! dir->nn->dir_ino)
     {
-      if (num_entries == -1 || count < num_entries)
-	{
-	  struct dirent hdr;
-	  size_t name_len = strlen (name);
-	  size_t sz = DIRENT_LEN (name_len);
+      err = _get_dir_ino (dir, &dir->nn->dir_ino);
+      if (err)
+	return err;
+    }
 
-	  if (sz > size)
-	    return 0;
-	  else
-	    size -= sz;
-	  
-	  hdr.d_fileno = fileno;
-	  hdr.d_reclen = sz;
-	  hdr.d_type = type;
-	  hdr.d_namlen = name_len;
+  /* Only a read beginning at the first entry checks the underlying
+     directories for changes, so that a client reading the directory
+     in several chunks usually continues from the listing it has
+     started with.  The listing is shared by all clients, though; if
+     it is replaced in between, the client may skip or repeat
+     entries.  */
+  if (first_entry == 0)
+    err = node_entries_get (dir, &dirents);
+  else
+    err = node_entries_snapshot (dir, &dirents);
+  if (err)
+    return err;
 
-	  memcpy (data_p, &hdr, DIRENT_NAME_OFFS);
-	  strcpy (data_p + DIRENT_NAME_OFFS, name);
-	  data_p += sz;
-	  count++;
+  /* The first two entries are `.' and `..'.  */
+  for (i = first_entry; i < 2; i++)
+    {
+      if (! fits (DIRENT_LEN (i + 1)))
+	break;
+      dots[dots_num++] = i;
+      size += DIRENT_LEN (i + 1);
+      count++;
+    }
+
+  if (first_entry <= 2)
+    start = 0;
+  else if (first_entry - 2 < dirents->num)
+    start = first_entry - 2;
+  else
+    start = dirents->num;
+
+  /* The records of the merged entries are ready to be sent in the
+     arena, one after another; find the last one fitting into the
+     result.  */
+  end = start;
+  if (i >= 2)
+    {
+      end = dirents->num;
+      if (num_entries != -1 && end - start > num_entries - count)
+	end = start + num_entries - count;
 
-	  return 1;
+      if (max_data_len > 0
+	  && size + entry_offset (end) - entry_offset (start) > max_data_len)
+	{
+	  /* Binary search for the largest END which fits.  */
+	  int lo = start, hi = end;
+
+	  while (lo < hi)
+	    {
+	      int mid = lo + (hi - lo + 1) / 2;
+
+	      if (size + entry_offset (mid) - entry_offset (start)
+		  <= max_data_len)
+		lo = mid;
+	      else
+		hi = mid - 1;
+	    }
+	  end = lo;
 	}
-      else
-	return 0;
     }
 
-  err = node_entries_get (dir, &dirent_list);
+  size += entry_offset (end) - entry_offset (start);
+  count += end - start;
 
-  if (! err)
+  /* Use the buffer supplied by the caller, if the result fits.  */
+  if (size > *data_len)
     {
-      for (dirent_start = dirent_list, count = 2;
-	   dirent_start && first_entry > count;
-	   dirent_start = dirent_start->next, count++);
-
-      count = 0;
-
-      /* Make space for the `.' and `..' entries.  */
-      if (first_entry == 0)
-	bump_size (".");
-      if (first_entry <= 1)
-	bump_size ("..");
-
-      /* See how much space we need for the result.  */
-      for (dirent_current = dirent_start;
-	   dirent_current;
-	   dirent_current = dirent_current->next)
-	if (! bump_size (dirent_current->dirent->d_name))
-	  break;
-
       *data = mmap (0, size, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
       err = ((void *) *data == (void *) -1) ? errno : 0;
+      if (err)
+	return err;
     }
 
-  if (! err)
+  data_p = *data;
+  *data_len = size;
+  *data_entries = count;
+
+  /* Add `.' and `..' entries.  The parent of the root is the root
+     itself; the inode number of other parents is the one reported for
+     the directory DIR was looked up in.  */
+  for (i = 0; i < dots_num; i++)
     {
-      data_p = *data;
-      *data_len = size;
-      *data_entries = count;
-      count = 0;
-
-      /* Add `.' and `..' entries.  */
-      if (first_entry == 0)
-	add_dirent (".", 2, DT_DIR);
-      if (first_entry <= 1)
-	add_dirent ("..", 2, DT_DIR);
-
-      for (dirent_current = dirent_start;
-	   dirent_current;
-	   dirent_current = dirent_current->next)
-	if (! add_dirent (dirent_current->dirent->d_name,
-			  2	/* FIXME */,
-			  dirent_current->dirent->d_type))
-	  break;
+      struct dirent *dirent = (struct dirent *) data_p;
+      size_t name_len = dots[i] + 1;
+      size_t sz = DIRENT_LEN (name_len);
+
+      memset (data_p, 0, sz);
+      if (dots[i] == 0 || dir == netfs_root_node)
+	dirent->d_fileno = dir->nn_stat.st_ino;
+      else
+	dirent->d_fileno = dir->nn->dir_ino;
+      dirent->d_reclen = sz;
+      dirent->d_type = DT_DIR;
+      dirent->d_namlen = name_len;
+      memcpy (dirent->d_name, "..", name_len);
+      data_p += sz;
     }
 
-  if (dirent_list)
-    node_entries_free (dirent_list);
+  memcpy (data_p, dirents->data + entry_offset (start),
+	  entry_offset (end) - entry_offset (start));
 
   fshelp_touch (&dir->nn_stat, TOUCH_ATIME, maptime);
 
@@ -28,11 +28,72 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <stdio.h>
+#include <maptime.h>
 
 #include "unionfs.h"
 #include "node.h"
 #include "ulfs.h"
 #include "lib.h"
+#include "pool.h"
+#include "ino.h"
+
+/* Maximum number of bytes read from an underlying directory at
+   once, may be overwritten by the user.  */
+size_t readdir_chunk_size = READDIR_CHUNK_SIZE;
+
+/* Number of seconds the information cached about the entries of a
+   directory is used without checking the underlying directories, may
+   be overwritten by the user.  */
+int cache_timeout = CACHE_TIMEOUT;
+
+/* Number of seconds the ports to the underlying directories of a
+   node are used without looking them up again, may be overwritten by
+   the user.  */
+int port_timeout = PORT_TIMEOUT;
+
+/* The result of looking up a name beneath a directory.  */
+struct node_name
+{
+  unsigned int hash;		/* Hash value of NAME.  */
+  char *name;			/* The name, or NULL for a free
+				   slot.  */
+  int layer;			/* Index of the first underlying
+				   filesystem containing NAME, or -1
+				   if it does not exist.  */
+};
+
+/* The names looked up beneath a directory.  Each name can only be
+   stored in the slot selected by its hash value, replacing the name
+   stored there before.  */
+typedef struct node_names
+{
+  struct node_name table[NAME_CACHE_SIZE];
+} node_names_t;
+
+/* A snapshot of the ports to the underlying filesystems of a node:
+   the root node's, as seen by node_update, or a directory's, used
+   while the directory is unlocked.  A snapshot is never modified
+   once made; it holds its own send rights, so that it stays usable
+   while the node is being changed.  */
+struct node_ports
+{
+  int references;		/* Protected by ROOT_PORTS_LOCK.  */
+  unsigned int gen;		/* Value of ULFS_GEN for the set of
+				   underlying filesystems.  */
+  unsigned int ulfs_id;		/* The highest ID in ULFS.  */
+  int num;			/* Number of entries in ULFS.  */
+  node_ulfs_t ulfs[];
+};
+
+/* The current snapshot of the ports of the root node, or NULL.  */
+static node_ports_t *root_ports;
+
+/* The generation of the current snapshot.  */
+static unsigned int root_ports_gen;
+
+/* The lock protecting ROOT_PORTS and the references of all
+   snapshots; it is only held for a few instructions.  */
+static struct mutex root_ports_lock = MUTEX_INITIALIZER;
 
 /* Declarations for functions only used in this file.  */
 
@@ -40,6 +101,9 @@
    structures.  */
 void node_ulfs_free (node_t *node);
 
+/* Recompute the memory used by NODE, which must be locked.  */
+static void node_memory_update (node_t *node);
+
 /* Create a new node, derived from a light node, add a reference to
    the light node.  */
 error_t
@@ -66,13 +130,19 @@ node_create (lnode_t *lnode, node_t **node)
     }
 
   node_new->nn->ulfs = NULL;
-
-  err = node_ulfs_init (node_new);
-  if (err)
-    {
-      node_destroy (node_new);
-      return err;
-    }
+  node_new->nn->update_time = 0;
+  node_new->nn->update_ulfs_gen = 0;
+  node_new->nn->update_ulfs_id = 0;
+  node_new->nn->ulfs_num = 0;
+  node_new->nn->dirents = NULL;
+  node_new->nn->names = NULL;
+  node_new->nn->stamps = NULL;
+  node_new->nn->stamps_num = 0;
+  node_new->nn->stamps_time = 0;
+  node_new->nn->cache_gen = 0;
+  node_new->nn->dir_ino = 0;
+  node_new->nn->ino_fsid_index = -1;
+  node_memory_update (node_new);
 
   lnode->node = node_new;
   lnode_ref_add (lnode);
@@ -80,6 +150,9 @@ node_create (lnode_t *lnode, node_t **node)
   node_new->nn->flags = 0;
   node_new->nn->ncache_next = NULL;
   node_new->nn->ncache_prev = NULL;
+  node_new->nn->ncache_referenced = 0;
+  node_new->nn->ncache_list = 0;
+  node_new->nn->ncache_memory = 0;
   *node = node_new;
 
   return err;
@@ -92,6 +165,7 @@ node_destroy (node_t *node)
 {
   debug_msg ("node destroy: %s", node->nn->lnode->name);
   assert (! (node->nn->ncache_next || node->nn->ncache_prev));
+  node_entries_invalidate (node);
   node_ulfs_free (node);
   mutex_lock (&node->nn->lnode->lock);
   node->nn->lnode->node = NULL;
@@ -100,87 +174,502 @@ node_destroy (node_t *node)
   free (node);
 }
 
+/* Lookup a file named NAME beneath the directory DIR on an
+   underlying filesystem with FLAGS as openflags.  Store the port in
+   *PORT and according stat information in *STAT.  The node itself is
+   opened first, so that our own root node is never entered; if it
+   has no translator, the port is used as is.  */
+static error_t
+node_lookup_under (file_t dir, char *name, int flags,
+		   file_t *port, struct stat *stat)
+{
+  error_t err;
+  int reusable = 1;
+  file_t p;
+
+  if (! port_valid (dir))
+    return ENOENT;
+
+  p = file_name_lookup_under (dir, name, flags | O_NOTRANS, 0);
+  if (! port_valid (p))
+    {
+      if (errno == ENOENT)
+	return ENOENT;
+
+      /* A translator might still grant FLAGS.  */
+      reusable = 0;
+      p = file_name_lookup_under (dir, name, O_NOTRANS, 0);
+      if (! port_valid (p))
+	return errno;
+    }
+
+  err = io_stat (p, stat);
+  if (err)
+    {
+      port_dealloc (p);
+      return err;
+    }
+
+  if (stat->st_ino == underlying_node_stat.st_ino
+      && stat->st_fsid == underlying_node_stat.st_fsid)
+    {
+      /* It's OUR root node.  */
+      port_dealloc (p);
+      return ELOOP;
+    }
+
+  if (reusable && ! (stat->st_mode & S_ITRANS))
+    {
+      *port = p;
+      return 0;
+    }
+
+  port_dealloc (p);
+  return file_lookup (dir, name, flags, 0, 0, port, stat);
+}
+
+/* Return non-zero if the ports to the underlying filesystems of
+   NODE, which must be locked, have been looked up during the last
+   PORT_TIMEOUT seconds.  */
+static int
+node_update_recent (node_t *node)
+{
+  struct timeval tv;
+
+  maptime_read (maptime, &tv);
+
+  return ((node->nn->flags & FLAG_NODE_ULFS_UPTODATE)
+	  && tv.tv_sec < node->nn->update_time + port_timeout);
+}
+
+/* Return non-zero if the ports to the underlying filesystems of
+   NODE, which must be locked, have been looked up during the last
+   PORT_TIMEOUT seconds and no underlying filesystem has been added
+   or removed since.  */
+int
+node_update_fresh (node_t *node)
+{
+  return (node_update_recent (node)
+	  && node->nn->update_ulfs_gen == root_ports_gen);
+}
+
+/* Compare the per-ulfs data pointed to by U0 and U1 by ID.  */
+static int
+node_ulfs_compare (const void *u0, const void *u1)
+{
+  const node_ulfs_t *n0 = *(node_ulfs_t * const *) u0;
+  const node_ulfs_t *n1 = *(node_ulfs_t * const *) u1;
+
+  return n0->id < n1->id ? -1 : n0->id > n1->id;
+}
+
+/* Store pointers to the NUM entries of per-ulfs data in ULFS ordered
+   by ID in *SORTED.  */
+static error_t
+node_ulfs_sort (node_ulfs_t *ulfs, int num, node_ulfs_t ***sorted)
+{
+  node_ulfs_t **s;
+  int i;
+
+  s = malloc (num * sizeof (node_ulfs_t *));
+  if (num && ! s)
+    return ENOMEM;
+
+  for (i = 0; i < num; i++)
+    s[i] = &ulfs[i];
+  qsort (s, num, sizeof (node_ulfs_t *), node_ulfs_compare);
+
+  *sorted = s;
+  return 0;
+}
+
+/* Return the per-ulfs data for the filesystem ID in SORTED, which
+   holds NUM entries ordered by ID, or NULL.  */
+static node_ulfs_t *
+node_ulfs_find (node_ulfs_t **sorted, int num, unsigned int id)
+{
+  node_ulfs_t key = { .id = id }, *keyp = &key, **found;
+
+  found = bsearch (&keyp, sorted, num, sizeof (node_ulfs_t *),
+		   node_ulfs_compare);
+  return found ? *found : NULL;
+}
+
+/* Shrink ULFS, which has room for more than NUM entries, to exactly
+   NUM entries and return it.  */
+static node_ulfs_t *
+node_ulfs_shrink (node_ulfs_t *ulfs, int num)
+{
+  node_ulfs_t *ulfs_new;
+
+  if (! num)
+    {
+      free (ulfs);
+      return NULL;
+    }
+
+  ulfs_new = realloc (ulfs, num * sizeof (node_ulfs_t));
+  return ulfs_new ? ulfs_new : ulfs;
+}
+
+/* Replace the per-ulfs data of NODE, which must be locked, with the
+   NUM entries in ULFS, deallocating the ports held before.  The
+   information cached about the entries of NODE refers to the
+   filesystems by their position in ULFS; it is dropped, unless NODE
+   is found on the same filesystems as before.  */
+static void
+node_ulfs_set (node_t *node, node_ulfs_t *ulfs, int num)
+{
+  struct netnode *nn = node->nn;
+  int i, same = (num == nn->ulfs_num);
+
+  for (i = 0; same && i < num; i++)
+    same = (ulfs[i].id == nn->ulfs[i].id);
+
+  node_ulfs_free (node);
+  nn->ulfs = node_ulfs_shrink (ulfs, num);
+  nn->ulfs_num = num;
+
+  if (same)
+    node_memory_update (node);
+  else
+    node_entries_invalidate (node);
+}
+
+/* Return the current snapshot of the ports of the root node with a
+   reference added, or NULL if there is none yet.  */
+static node_ports_t *
+node_root_ports_get (void)
+{
+  node_ports_t *ports;
+
+  mutex_lock (&root_ports_lock);
+  ports = root_ports;
+  if (ports)
+    ports->references++;
+  mutex_unlock (&root_ports_lock);
+
+  return ports;
+}
+
+/* Remove a reference from the snapshot PORTS, freeing it if that was
+   the last one.  */
+void
+node_ports_release (node_ports_t *ports)
+{
+  int i;
+
+  mutex_lock (&root_ports_lock);
+  if (--ports->references)
+    ports = NULL;
+  mutex_unlock (&root_ports_lock);
+
+  if (ports)
+    {
+      for (i = 0; i < ports->num; i++)
+	if (port_valid (ports->ulfs[i].port))
+	  port_dealloc (ports->ulfs[i].port);
+      free (ports);
+    }
+}
+
+/* Store a new snapshot of the ports of NODE, which must be locked,
+   holding one reference in *PORTS.  */
+error_t
+node_ports_make (node_t *node, node_ports_t **ports)
+{
+  node_ports_t *p;
+  int i = 0;
+
+  p = malloc (sizeof (node_ports_t)
+	      + node->nn->ulfs_num * sizeof (node_ulfs_t));
+  if (! p)
+    return ENOMEM;
+
+  p->references = 1;
+  p->gen = node->nn->update_ulfs_gen;
+  p->ulfs_id = node->nn->update_ulfs_id;
+  p->num = node->nn->ulfs_num;
+  node_ulfs_iterate_unlocked (node)
+    {
+      p->ulfs[i] = *node_ulfs;
+      if (port_valid (node_ulfs->port))
+	mach_port_mod_refs (mach_task_self (), node_ulfs->port,
+			    MACH_PORT_RIGHT_SEND, 1);
+      i++;
+    }
+
+  *ports = p;
+  return 0;
+}
+
+/* Publish a new snapshot of the ports of the root node NODE, which
+   must be locked or not yet visible to other threads.  */
+static error_t
+node_root_ports_publish (node_t *node)
+{
+  node_ports_t *ports, *old;
+  error_t err;
+
+  err = node_ports_make (node, &ports);
+  if (err)
+    return err;
+
+  mutex_lock (&root_ports_lock);
+  old = root_ports;
+  root_ports = ports;
+  root_ports_gen = ports->gen;
+  mutex_unlock (&root_ports_lock);
+
+  /* Threads still using the old snapshot keep it alive.  */
+  if (old)
+    node_ports_release (old);
+
+  return 0;
+}
+
+/* Look up the ports to the underlying filesystems of NODE, which
+   must be locked and must not be an entry of the root node, beneath
+   the ports of its parent, which are brought uptodate first.  Only a
+   single name is looked up on each filesystem, whatever the depth of
+   NODE.  NODE is unlocked meanwhile; no light node may be locked by
+   the caller.  Return zero if the parent is not in memory, leaving
+   NODE alone; otherwise store the error in *ERR.  */
+static int
+node_update_parent (node_t *node, error_t *err)
+{
+  lnode_t *dir_lnode = node->nn->lnode->dir;
+  struct stat stat;
+  node_t *dir;
+
+  /* NODE must not be held while locking its parent.  */
+  mutex_unlock (&node->lock);
+
+  mutex_lock (&dir_lnode->lock);
+  dir = dir_lnode->node;
+  if (dir)
+    netfs_nref (dir);
+  mutex_unlock (&dir_lnode->lock);
+
+  if (! dir)
+    {
+      mutex_lock (&node->lock);
+      return 0;
+    }
+
+  mutex_lock (&dir->lock);
+
+  *err = node_update (dir);
+
+  mutex_lock (&dir_lnode->lock);
+  mutex_lock (&node->lock);
+
+  /* NODE may have been updated by another thread meanwhile.  */
+  if (! *err && ! node_update_fresh (node))
+    {
+      *err = node_update_under (node, dir, &stat);
+
+      /* NODE not existing on some or all of the filesystems is
+	 reflected in its ports, just as in node_update.  */
+      if (*err != ENOMEM)
+	*err = 0;
+    }
+
+  mutex_unlock (&dir_lnode->lock);
+  mutex_unlock (&dir->lock);
+
+  /* Releasing DIR might destroy it, which locks its light node.  */
+  mutex_unlock (&node->lock);
+  netfs_nrele (dir);
+  mutex_lock (&node->lock);
+
+  return 1;
+}
+
 /* Make sure that all ports to the underlying filesystems of NODE,
-   which must be locked, are uptodate.  */
+   which must be locked, are uptodate.  Only the filesystems on which
+   NODE exists are kept in NODE.  */
 error_t
 node_update (node_t *node)
 {
   error_t err = 0;
   char *path;
 
-  node_ulfs_t *root_ulfs;
+  struct netnode *nn = node->nn;
+  node_ulfs_t *ulfs_new, **sorted = NULL;
+  node_ports_t *root;
   struct stat stat;
+  struct timeval tv;
   file_t port;
-  int i = 0;
+  int recent, num = 0, i;
   
-  debug_msg ("node_update for lnode: %s", node->nn->lnode->name);
+  debug_msg ("node_update for lnode: %s", nn->lnode->name);
 
   if (node_is_root (node))
     return err;
 
-  mutex_lock (&netfs_root_node->lock);
+  /* Ports looked up beneath the parent are still fresh.  */
+  if (node_update_fresh (node))
+    return err;
+
+  maptime_read (maptime, &tv);
+  recent = node_update_recent (node);
 
-  err = lnode_path_construct (node->nn->lnode, &path);
+  /* Ports which have timed out are looked up again beneath the ports
+     of the parent, if it is in memory and not the root node, whose
+     ports are found without locking it below.  */
+  if (! recent && nn->lnode->dir->dir && node_update_parent (node, &err))
+    return err;
+
+  /* The root node is not locked; updates of unrelated nodes run in
+     parallel.  */
+  root = node_root_ports_get ();
+  if (! root)
+    return err;
+
+  ulfs_new = malloc (root->num * sizeof (node_ulfs_t));
+  if (root->num && ! ulfs_new)
+    err = ENOMEM;
+
+  /* If only the set of underlying filesystems has changed since the
+     last update, the ports to the filesystems which have been added
+     are all that needs to be looked up.  */
+  if (! err && recent)
+    err = node_ulfs_sort (nn->ulfs, nn->ulfs_num, &sorted);
+
+  if (! err)
+    err = lnode_path_construct (nn->lnode, &path);
   if (err)
     {
-      mutex_unlock (&netfs_root_node->lock);
+      free (sorted);
+      free (ulfs_new);
+      node_ports_release (root);
       return err;
     }
 
-  root_ulfs = netfs_root_node->nn->ulfs;
-
-  node_ulfs_iterate_unlocked (node)
+  for (i = 0; i < root->num; i++)
     {
-  
-      if (node_ulfs->flags & FLAG_NODE_ULFS_FIXED)
-	{
-	  i++;
-	  continue;
-	}
-      
-      /* We really have to update the port.  */
-      if (port_valid (node_ulfs->port))
-	port_dealloc (node_ulfs->port);
+      node_ulfs_t *ulfs = root->ulfs + i;
 
-      err = file_lookup ((root_ulfs + i)->port, path,
-			 O_READ | O_NOTRANS, O_NOTRANS,
-			 0, &port, &stat);
-      
-      if (err)
+      if (recent)
 	{
-	  node_ulfs->port = MACH_PORT_NULL;
-	  err = 0;
-	  i++;
-	  continue;
+	  node_ulfs_t *found = node_ulfs_find (sorted, nn->ulfs_num,
+					       ulfs->id);
+	  if (found)
+	    {
+	      ulfs_new[num++] = *found;
+	      found->port = port_null;
+	      continue;
+	    }
+
+	  /* IDs are handed out in increasing order; NODE is known not
+	     to exist on the filesystems registered before its last
+	     update.  */
+	  if (ulfs->id <= nn->update_ulfs_id)
+	    continue;
 	}
-      
-      if (stat.st_ino == underlying_node_stat.st_ino
-	  && stat.st_fsid == underlying_node_stat.st_fsid)
-	/* It's OUR root node.  */
-	err = ELOOP;
-      else
+
+      if (node_lookup_under (ulfs->port, path, O_READ, &port, &stat))
+	continue;
+
+      ulfs_new[num].flags = ulfs->flags & FLAG_NODE_ULFS_WRITABLE;
+      ulfs_new[num].port = port;
+      ulfs_new[num].id = ulfs->id;
+      num++;
+    }
+
+  free (path);
+  free (sorted);
+  node_ulfs_set (node, ulfs_new, num);
+
+  nn->flags |= FLAG_NODE_ULFS_UPTODATE;
+  nn->update_ulfs_gen = root->gen;
+  nn->update_ulfs_id = root->ulfs_id;
+  if (! recent)
+    nn->update_time = tv.tv_sec;
+
+  node_ports_release (root);
+  
+  return err;
+}
+
+/* Look up the ports to the underlying filesystems of NODE beneath the
+   ports of its parent DIR, which must be uptodate.  DIR, its light
+   node and NODE must be locked; they are all unlocked while the
+   underlying filesystems are asked, so that a slow filesystem does
+   not block other operations on DIR, and locked again before
+   returning.  Return the error of the lookup on the first filesystem
+   on which it did not fail with ENOENT; on success, store the
+   according stat information in *STAT.  */
+error_t
+node_update_under (node_t *node, node_t *dir, struct stat *stat)
+{
+  char *name = node->nn->lnode->name;
+  error_t err, first_err = ENOENT;
+  lnode_t *dir_lnode = dir->nn->lnode;
+  node_ulfs_t *ulfs_new;
+  node_ports_t *ports;
+  struct stat st;
+  struct timeval tv;
+  file_t port;
+  int num = 0, i;
+
+  debug_msg ("node_update_under for lnode: %s", name);
+
+  maptime_read (maptime, &tv);
+
+  err = node_ports_make (dir, &ports);
+  if (err)
+    return err;
+
+  ulfs_new = malloc (ports->num * sizeof (node_ulfs_t));
+  if (ports->num && ! ulfs_new)
+    {
+      node_ports_release (ports);
+      return ENOMEM;
+    }
+
+  /* NODE is unlocked first, as it must not be held while locking
+     DIR again.  */
+  mutex_unlock (&node->lock);
+  mutex_unlock (&dir_lnode->lock);
+  mutex_unlock (&dir->lock);
+
+  for (i = 0; i < ports->num; i++)
+    {
+      err = node_lookup_under (ports->ulfs[i].port, name, O_READ,
+			       &port, &st);
+
+      if (first_err == ENOENT)
 	{
-	  port_dealloc (port);
-	  err = file_lookup ((root_ulfs + i)->port, path,
-			     O_READ, 0, 0, &port, &stat);
+	  first_err = err;
+	  if (! err)
+	    *stat = st;
 	}
-      
+
       if (err)
-	{
-	  port = MACH_PORT_NULL;
-	  err = 0;
-	}
-      node_ulfs->port = port;
-      
-      i++;
+	continue;
+
+      ulfs_new[num].flags = ports->ulfs[i].flags & FLAG_NODE_ULFS_WRITABLE;
+      ulfs_new[num].port = port;
+      ulfs_new[num].id = ports->ulfs[i].id;
+      num++;
     }
 
-  free (path);
+  mutex_lock (&dir->lock);
+  mutex_lock (&dir_lnode->lock);
+  mutex_lock (&node->lock);
+
+  node_ulfs_set (node, ulfs_new, num);
+
   node->nn->flags |= FLAG_NODE_ULFS_UPTODATE;
+  node->nn->update_time = tv.tv_sec;
+  node->nn->update_ulfs_gen = ports->gen;
+  node->nn->update_ulfs_id = ports->ulfs_id;
 
-  mutex_unlock (&netfs_root_node->lock);
-  
-  return err;
+  node_ports_release (ports);
+
+  return first_err;
 }
 
 /* Remove all directory named NAME beneath DIR on all underlying filesystems.
@@ -275,54 +764,68 @@ node_unlink_file (node_t *dir, char *name)
   return err;
 }
 
-/* Lookup a file named NAME beneath DIR on the underlying filesystems
-   with FLAGS as openflags.  Return the first port successfully looked
-   up in *PORT and according stat information in *STAT.  */
-error_t
-node_lookup_file (node_t *dir, char *name, int flags,
-		  file_t *port, struct stat *s)
+/* Look up NAME beneath the NUM underlying directories in ULFS, see
+   node_lookup_file_layer.  */
+static error_t
+node_lookup_ulfs (node_ulfs_t *ulfs, int num, char *name, int flags,
+		  int *layer, file_t *port, struct stat *s)
 {
   error_t err = ENOENT;
   struct stat stat;
   file_t p;
-
-  node_ulfs_iterate_unlocked (dir)
-    {
-
-      if (err != ENOENT)
-	break;
-
-      if (!port_valid (node_ulfs->port))
-	continue;
-
-      err = file_lookup (node_ulfs->port, name,
-			 flags | O_NOTRANS, O_NOTRANS,
-			 0, &p, &stat);
-      if (err)
-	continue;
-
-      if (stat.st_ino == underlying_node_stat.st_ino
-	  && stat.st_fsid == underlying_node_stat.st_fsid)
-	/* It's OUR root node.  */
-	err = ELOOP;
-      else 
-	/* stat.st_mode & S_ITRANS  */
-	{
-	  port_dealloc (p);
-	  err = file_lookup (node_ulfs->port, name,
-			     flags, 0, 0, &p, &stat);
-	}
-    }
+  int i = *layer;
+
+  if (i > 0 && i < num)
+    err = node_lookup_under (ulfs[i].port, name, flags, &p, &stat);
+
+  if (err == ENOENT)
+    /* NAME has been shadowed or removed; fall back to the full
+       scan.  */
+    for (i = 0; i < num; i++)
+      {
+	err = node_lookup_under (ulfs[i].port, name, flags, &p, &stat);
+	if (err != ENOENT)
+	  break;
+      }
 
   if (! err)
     {
       *s = stat;
       *port = p;
+      *layer = i;
     }
 
   return err;
 }
 
+/* Lookup a file named NAME beneath DIR, which must be locked, on the
+   underlying filesystems with FLAGS as openflags.  Return the first
+   port successfully looked up in *PORT and according stat
+   information in *STAT.  */
+error_t
+node_lookup_file (node_t *dir, char *name, int flags,
+		  file_t *port, struct stat *s)
+{
+  int layer = 0;
+
+  return node_lookup_ulfs (dir->nn->ulfs, dir->nn->ulfs_num, name, flags,
+			   &layer, port, s);
+}
+
+/* Like node_lookup_file, but look up NAME beneath the directories in
+   the snapshot PORTS, so that the directory need not be locked, and
+   first try the underlying filesystem with the index *LAYER, which is
+   known to be the first one containing NAME; only if NAME does not
+   exist there, try all of them.  On success, store the index of the
+   filesystem *PORT belongs to in *LAYER.  */
+error_t
+node_lookup_file_layer (node_ports_t *ports, char *name, int flags,
+			int *layer, file_t *port, struct stat *s)
+{
+  return node_lookup_ulfs (ports->ulfs, ports->num, name, flags, layer,
+			   port, s);
+}
+
 /* Deallocate all ports contained in NODE and free per-ulfs data
    structures.  */
 void
@@ -339,145 +842,689 @@ node_ulfs_free (node_t *node)
   free (node->nn->ulfs);
 }
 
-/* Initialize per-ulfs data structures for NODE.  The ulfs_lock must
-   be held by the caller.  */
-error_t
-node_ulfs_init (node_t *node)
+/* Recompute the memory used by NODE, which must be locked.  */
+static void
+node_memory_update (node_t *node)
 {
-  node_ulfs_t *ulfs_new;
-  error_t err = 0;
-  
-  ulfs_new = malloc (ulfs_num * sizeof (node_ulfs_t));
-  if (! ulfs_new)
+  struct netnode *nn = node->nn;
+  size_t memory;
+
+  memory = (sizeof (struct node) + sizeof (netnode_t)
+	    + nn->ulfs_num * sizeof (node_ulfs_t));
+  if (nn->stamps)
+    memory += nn->ulfs_num * sizeof (node_stamp_t);
+  if (nn->dirents)
+    memory += (sizeof (node_dirents_t) + nn->dirents->data_alloced
+	       + nn->dirents->alloced * sizeof (node_dirent_t)
+	       + nn->dirents->table_size * sizeof (int));
+  if (nn->names)
+    memory += sizeof (node_names_t);
+
+  nn->memory = memory;
+}
+
+/* Rebuild the hash table of DIRENTS with SIZE slots, which must be a
+   power of two.  */
+static error_t
+node_dirents_rehash (node_dirents_t *dirents, int size)
+{
+  int *table;
+  int i;
+
+  table = calloc (size, sizeof (int));
+  if (! table)
+    return ENOMEM;
+
+  for (i = 0; i < dirents->num; i++)
     {
-      err = ENOMEM;
-      return err;
+      int slot = dirents->entries[i].hash & (size - 1);
+
+      while (table[slot])
+	slot = (slot + 1) & (size - 1);
+      table[slot] = i + 1;
     }
 
-  if (node->nn->ulfs)
-    node_ulfs_free (node);
+  free (dirents->table);
+  dirents->table = table;
+  dirents->table_size = size;
+  return 0;
+}
 
-  node->nn->ulfs = ulfs_new;
-  node->nn->ulfs_num = ulfs_num;
-      
-  node_ulfs_iterate_unlocked (node)
+/* Add a dirent named NAME, found at position SEQ in the directory of
+   the underlying filesystem with the index LAYER, to DIRENTS.  If an
+   entry with the specified name already exists, reuse that entry;
+   the first filesystem containing it provides FILENO and TYPE.
+   Otherwise append a new one.  */
+static error_t
+node_dirents_add (node_dirents_t *dirents, char *name, ino_t fileno,
+		  int type, int layer, int seq)
+{
+  node_dirent_t *entry;
+  struct dirent *dirent;
+  size_t name_len, size;
+  unsigned int hash;
+  int slot, i;
+  error_t err;
+
+  hash = name_hash (name, &name_len);
+
+  /* Keep the load factor of the table below 3/4.  */
+  if ((dirents->num + 1) * 4 > dirents->table_size * 3)
     {
-      node_ulfs->flags = 0;
-      node_ulfs->port = port_null;
+      err = node_dirents_rehash (dirents, (dirents->table_size
+					   ? dirents->table_size * 2 : 64));
+      if (err)
+	return err;
     }
 
-  return err;
+  for (slot = hash & (dirents->table_size - 1);
+       (i = dirents->table[slot]);
+       slot = (slot + 1) & (dirents->table_size - 1))
+    {
+      entry = dirents->entries + i - 1;
+      if (entry->hash != hash)
+	continue;
+
+      dirent = node_dirent_get (dirents, entry);
+      if (dirent->d_namlen == name_len && ! strcmp (dirent->d_name, name))
+	{
+	  /* Reuse existing entry.  The first filesystem containing
+	     the name is the one lookups and stat use.  */
+	  if (layer < entry->layer)
+	    {
+	      entry->layer = layer;
+	      entry->seq = seq;
+	      dirent->d_fileno = fileno;
+	      dirent->d_type = type;
+	    }
+	  return 0;
+	}
+    }
+
+  /* Create new entry.  */
+
+  if (dirents->num == dirents->alloced)
+    {
+      int alloced = dirents->alloced ? dirents->alloced * 2 : 64;
+
+      entry = realloc (dirents->entries, alloced * sizeof (node_dirent_t));
+      if (! entry)
+	return ENOMEM;
+      dirents->entries = entry;
+      dirents->alloced = alloced;
+    }
+
+  size = DIRENT_LEN (name_len);
+  if (dirents->data_size + size > dirents->data_alloced)
+    {
+      size_t alloced = dirents->data_alloced ? dirents->data_alloced : 4096;
+      char *data;
+
+      while (dirents->data_size + size > alloced)
+	alloced *= 2;
+
+      data = realloc (dirents->data, alloced);
+      if (! data)
+	return ENOMEM;
+      dirents->data = data;
+      dirents->data_alloced = alloced;
+    }
+
+  entry = dirents->entries + dirents->num;
+  entry->offset = dirents->data_size;
+  entry->hash = hash;
+  entry->layer = layer;
+  entry->seq = seq;
+
+  /* Fill dirent.  */
+  dirent = node_dirent_get (dirents, entry);
+  dirent->d_fileno = fileno;
+  dirent->d_type = type;
+  dirent->d_reclen = size;
+  dirent->d_namlen = name_len;
+  memcpy (dirent->d_name, name, name_len);
+
+  /* The record is sent to clients as is; do not leak the contents of
+     the padding.  */
+  memset (dirent->d_name + name_len, 0,
+	  size - DIRENT_NAME_OFFS - name_len);
+
+  dirents->data_size += size;
+  dirents->table[slot] = ++dirents->num;
+
+  return 0;
 }
 
-/* Read the merged directory entries from NODE, which must be
-   locked, into *DIRENTS.  */
-error_t
-node_entries_get (node_t *node, node_dirent_t **dirents)
+/* Arguments for node_stamp_get.  */
+struct node_stamps_args
 {
-  struct dirent **dirent_list, **dirent;
-  node_dirent_t *node_dirent_list = NULL;
-  size_t dirent_data_size;
-  char *dirent_data;
-  error_t err = 0;
+  node_t *node;
+  node_stamp_t *stamps;
+};
 
-  /* Add a dirent to the list.  If an entry with the specified name
-     already exists, reuse that entry.  Otherwise create a new
-     one.  */
-  error_t node_dirent_add (char *name, ino_t fileno, int type)
+/* Store the current stamp of the underlying directory with the index
+   I in the stamps described by PRIV.  */
+static void
+node_stamp_get (int i, void *priv)
+{
+  struct node_stamps_args *args = priv;
+  node_ulfs_t *node_ulfs = args->node->nn->ulfs + i;
+  node_stamp_t *stamp = args->stamps + i;
+  struct stat st;
+
+  memset (stamp, 0, sizeof (node_stamp_t));
+  if (port_valid (node_ulfs->port)
+      && ! io_stat (node_ulfs->port, &st))
     {
-      error_t e = 0;
-      node_dirent_t *node_dirent;
-      node_dirent_t *node_dirent_new;
-      struct dirent *dirent_new;
-      int name_len = strlen (name);
-      int size = DIRENT_LEN (name_len);
+      stamp->valid = 1;
+      stamp->ino = st.st_ino;
+      stamp->fsid = st.st_fsid;
+      stamp->size = st.st_size;
+      stamp->mtime = st.st_mtime;
+      stamp->ctime = st.st_ctime;
+    }
+}
 
+/* Store the current stamps of the underlying directories of NODE,
+   which must be locked, in STAMPS.  */
+static void
+node_stamps_get (node_t *node, node_stamp_t *stamps)
+{
+  struct node_stamps_args args = { node, stamps };
 
-      for (node_dirent = node_dirent_list;
-	   node_dirent && strcmp (node_dirent->dirent->d_name, name);
-	   node_dirent = node_dirent->next);
+  pool_run (node->nn->ulfs_num, node_stamp_get, &args);
+}
 
-      if (node_dirent)
-	{
-	  /* Reuse existing entry.  */
+/* Return non-zero if the stamps S0 and S1 describe the same state of
+   an underlying directory.  */
+static int
+node_stamp_equal (node_stamp_t *s0, node_stamp_t *s1)
+{
+  if (! s0->valid || ! s1->valid)
+    return s0->valid == s1->valid;
 
-	  node_dirent->dirent->d_fileno = fileno;
-	  node_dirent->dirent->d_type = type;
-	  return e;
-	}
+  return (s0->ino == s1->ino && s0->fsid == s1->fsid
+	  && s0->size == s1->size
+	  && s0->mtime == s1->mtime && s0->ctime == s1->ctime);
+}
 
-      /* Create new entry.  */
-      
-      node_dirent_new = malloc (sizeof (node_dirent_t));
-      if (!node_dirent_new)
+/* Return non-zero if the NUM stamps in STAMPS, which have been taken
+   at time NOW, may be trusted.  Timestamps only have a resolution of
+   one second, so a directory which has been modified during the
+   second the stamp was taken in may be modified again without its
+   stamp changing.  */
+static int
+node_stamps_trusted (node_stamp_t *stamps, int num, time_t now)
+{
+  int i;
+
+  for (i = 0; i < num; i++)
+    if (stamps[i].valid
+	&& (stamps[i].mtime >= now || stamps[i].ctime >= now))
+      return 0;
+
+  return 1;
+}
+
+/* Compare the entries E0 and E1 by the first underlying filesystem
+   containing them and their position in it.  */
+static int
+node_dirent_compare (const void *e0, const void *e1)
+{
+  const node_dirent_t *d0 = e0, *d1 = e1;
+
+  if (d0->layer != d1->layer)
+    return d0->layer < d1->layer ? -1 : 1;
+  return d0->seq < d1->seq ? -1 : d0->seq > d1->seq;
+}
+
+/* Bring the entries of DIRENTS, which have been merged from the
+   underlying filesystems in no particular order, into the order in
+   which a sequential merge would have produced them.  */
+static error_t
+node_dirents_sort (node_dirents_t *dirents)
+{
+  char *data;
+  size_t offset = 0;
+  int i;
+
+  for (i = 1; i < dirents->num; i++)
+    if (node_dirent_compare (dirents->entries + i - 1,
+			     dirents->entries + i) > 0)
+      break;
+  if (i >= dirents->num)
+    /* Already in order.  */
+    return 0;
+
+  data = malloc (dirents->data_size);
+  if (! data)
+    return ENOMEM;
+
+  qsort (dirents->entries, dirents->num, sizeof (node_dirent_t),
+	 node_dirent_compare);
+
+  /* Lay out the dirent records in the new order as well.  */
+  for (i = 0; i < dirents->num; i++)
+    {
+      struct dirent *dirent = node_dirent_get (dirents, dirents->entries + i);
+
+      memcpy (data + offset, dirent, dirent->d_reclen);
+      dirents->entries[i].offset = offset;
+      offset += dirent->d_reclen;
+    }
+
+  free (dirents->data);
+  dirents->data = data;
+  dirents->data_alloced = dirents->data_size;
+
+  return node_dirents_rehash (dirents, dirents->table_size);
+}
+
+/* State shared by the threads reading the underlying directories of
+   a node.  */
+struct node_entries_reader
+{
+  node_t *node;
+  node_dirents_t *dirents;
+  struct mutex lock;		/* Protects DIRENTS and ERR.  */
+  error_t err;
+};
+
+/* State of the thread reading one underlying directory.  */
+struct node_entries_layer
+{
+  struct node_entries_reader *reader;
+  int layer;			/* Index of the filesystem.  */
+  int seq;			/* Position of the next entry.  */
+};
+
+/* Merge the directory entry DIRENT, read by the thread described by
+   PRIV, into the listing.  */
+static error_t
+node_dirents_merge (struct dirent *dirent, void *priv)
+{
+  struct node_entries_layer *layer = priv;
+  struct node_entries_reader *reader = layer->reader;
+  int seq = layer->seq++;
+  error_t err;
+
+  if (! strcmp (dirent->d_name, ".") || ! strcmp (dirent->d_name, ".."))
+    return 0;
+
+  mutex_lock (&reader->lock);
+  err = reader->err;
+  if (! err)
+    err = node_dirents_add (reader->dirents, dirent->d_name,
+			    dirent->d_fileno, dirent->d_type,
+			    layer->layer, seq);
+  mutex_unlock (&reader->lock);
+
+  return err;
+}
+
+/* Read the directory of the underlying filesystem with the index I
+   into the listing of the reader PRIV.  */
+static void
+node_entries_read_layer (int i, void *priv)
+{
+  struct node_entries_reader *reader = priv;
+  struct node_entries_layer layer = { reader, i, 0 };
+  file_t port = reader->node->nn->ulfs[i].port;
+  error_t err;
+
+  if (! port_valid (port))
+    return;
+
+  err = dir_entries_iterate (port, readdir_chunk_size,
+			     node_dirents_merge, &layer);
+
+  /* Directories which cannot be read are skipped, but the listing
+     cannot tell that a name does not exist anymore.  */
+  if (err)
+    {
+      mutex_lock (&reader->lock);
+      if (err == ENOMEM)
+	reader->err = err;
+      else
+	reader->dirents->complete = 0;
+      mutex_unlock (&reader->lock);
+    }
+}
+
+/* Replace the inode numbers of the directories in DIRENTS, which have
+   been read from the underlying directories with the stamps STAMPS,
+   with the ones unionfs reports for them.  */
+static error_t
+node_dirents_map_ino (node_dirents_t *dirents, node_stamp_t *stamps)
+{
+  node_dirent_t *entry;
+  int layer = -1;
+  int fsid_index = 0;
+  error_t err;
+
+  for (entry = dirents->entries;
+       entry < dirents->entries + dirents->num;
+       entry++)
+    {
+      struct dirent *dirent = node_dirent_get (dirents, entry);
+
+      if (dirent->d_type != DT_DIR)
+	/* Other files are not served by unionfs.  */
+	continue;
+
+      /* The entries are ordered by layer.  */
+      if (entry->layer != layer)
 	{
-	  e = ENOMEM;
-	  return e;
+	  err = ino_fsid_index (stamps[entry->layer].fsid, &fsid_index);
+	  if (err)
+	    return err;
+	  layer = entry->layer;
 	}
+      err = ino_map (fsid_index, dirent->d_fileno, &dirent->d_fileno);
+      if (err)
+	return err;
+    }
+
+  return 0;
+}
+
+/* Read the merged directory entries of NODE, which must be locked,
+   from the underlying directories with the stamps STAMPS into
+   *DIRENTS.  The directories are read in parallel, each in chunks of
+   at most READDIR_CHUNK_SIZE bytes, which are merged as they
+   arrive.  */
+static error_t
+node_entries_read (node_t *node, node_stamp_t *stamps,
+		   node_dirents_t **dirents)
+{
+  struct node_entries_reader reader;
+  error_t err;
+
+  reader.node = node;
+  reader.err = 0;
+  mutex_init (&reader.lock);
+  reader.dirents = calloc (1, sizeof (node_dirents_t));
+  if (! reader.dirents)
+    return ENOMEM;
+  reader.dirents->complete = 1;
+
+  pool_run (node->nn->ulfs_num, node_entries_read_layer, &reader);
 
-      dirent_new = malloc (size);
-      if (!dirent_new)
+  err = reader.err;
+  if (! err)
+    err = node_dirents_sort (reader.dirents);
+  if (! err)
+    err = node_dirents_map_ino (reader.dirents, stamps);
+
+  if (err)
+    node_entries_free (reader.dirents);
+  else
+    *dirents = reader.dirents;
+
+  return err;
+}
+
+/* Make sure that the information cached about the entries of NODE,
+   which must be locked, is uptodate.  The underlying directories are
+   only checked if they have not been found unchanged during the last
+   CACHE_TIMEOUT seconds; if one of them has changed, all cached
+   information is dropped and the new stamps are stored in NODE.  */
+static error_t
+node_cache_validate (node_t *node)
+{
+  struct netnode *nn = node->nn;
+  node_stamp_t *stamps;
+  struct timeval tv;
+  int i;
+
+  maptime_read (maptime, &tv);
+
+  if (nn->stamps_num == nn->ulfs_num && nn->stamps_num
+      && tv.tv_sec < nn->stamps_time + cache_timeout)
+    return 0;
+
+  stamps = malloc (nn->ulfs_num * sizeof (node_stamp_t));
+  if (! stamps)
+    return ENOMEM;
+
+  node_stamps_get (node, stamps);
+
+  if (nn->stamps_num == nn->ulfs_num && nn->stamps_num)
+    {
+      for (i = 0; i < nn->ulfs_num; i++)
+	if (! node_stamp_equal (nn->stamps + i, stamps + i))
+	  break;
+
+      if (i == nn->ulfs_num)
 	{
-	  free (node_dirent_new);
-	  e = ENOMEM;
-	  return e;
+	  /* Nothing has changed.  */
+	  free (stamps);
+	  nn->stamps_time = tv.tv_sec;
+	  return 0;
 	}
+    }
 
-      /* Fill dirent.  */
-      dirent_new->d_fileno = fileno;
-      dirent_new->d_type = type;
-      dirent_new->d_reclen = size;
-      strcpy ((char *) dirent_new + DIRENT_NAME_OFFS, name);
-      
-      /* Add dirent to the list.  */
-      node_dirent_new->dirent = dirent_new;
-      node_dirent_new->next = node_dirent_list;
-      node_dirent_list = node_dirent_new;
-      
-      return e;
+  node_entries_invalidate (node);
+
+  /* Information read from stamps which cannot be trusted is dropped
+     on the next call.  */
+  nn->stamps = stamps;
+  nn->stamps_num = (node_stamps_trusted (stamps, nn->ulfs_num, tv.tv_sec)
+		    ? nn->ulfs_num : 0);
+  nn->stamps_time = tv.tv_sec;
+  node_memory_update (node);
+
+  return 0;
+}
+
+/* Store the merged directory entries of NODE, which must be locked,
+   in *DIRENTS.  The listing is cached in NODE and only read again
+   when one of the underlying directories has changed; it belongs to
+   NODE and stays valid until NODE is unlocked.  */
+error_t
+node_entries_get (node_t *node, node_dirents_t **dirents)
+{
+  struct netnode *nn = node->nn;
+  error_t err;
+
+  err = node_cache_validate (node);
+  if (err)
+    return err;
+
+  if (! nn->dirents)
+    {
+      /* A listing read from stamps which cannot be trusted still
+	 serves snapshots.  */
+      err = node_entries_read (node, nn->stamps, &nn->dirents);
+      if (err)
+	return err;
+      node_memory_update (node);
     }
 
-  node_ulfs_iterate_unlocked(node)
+  *dirents = nn->dirents;
+  return 0;
+}
+
+/* Like node_entries_get, but if NODE already caches a listing,
+   return it without checking the underlying directories.  This keeps
+   the entry numbers stable while a client reads a directory in
+   several chunks, as long as the cached listing is not replaced
+   meanwhile; it is not tied to the client, so a read from the first
+   entry seeing changes, or the listing being dropped, makes the
+   remaining chunks come from the new listing, which may skip or
+   repeat entries.  */
+error_t
+node_entries_snapshot (node_t *node, node_dirents_t **dirents)
+{
+  if (! node->nn->dirents)
+    return node_entries_get (node, dirents);
+
+  *dirents = node->nn->dirents;
+  return 0;
+}
+
+/* Return the entry of DIRENTS named NAME, which has the hash value
+   HASH and the length LEN, or NULL if there is none.  */
+static node_dirent_t *
+node_dirents_find (node_dirents_t *dirents, char *name,
+		   unsigned int hash, size_t len)
+{
+  int slot, i;
+
+  if (! dirents->table_size)
+    return NULL;
+
+  for (slot = hash & (dirents->table_size - 1);
+       (i = dirents->table[slot]);
+       slot = (slot + 1) & (dirents->table_size - 1))
     {
-      if (!port_valid (node_ulfs->port))
-	continue;
+      node_dirent_t *entry = dirents->entries + i - 1;
+      struct dirent *dirent;
 
-      err = dir_entries_get (node_ulfs->port, &dirent_data,
-			     &dirent_data_size, &dirent_list);
-      if (err)
+      if (entry->hash != hash)
 	continue;
-      
-      for (dirent = dirent_list; (! err) && *dirent; dirent++)
-	if (strcmp ((*dirent)->d_name, ".")
-	    && strcmp ((*dirent)->d_name, ".."))
-	  err = node_dirent_add ((*dirent)->d_name,
-				 (*dirent)->d_fileno,
-				 (*dirent)->d_type);
 
-      free (dirent_list);
-      munmap (dirent_data, dirent_data_size);
+      dirent = node_dirent_get (dirents, entry);
+      if (dirent->d_namlen == len && ! strcmp (dirent->d_name, name))
+	return entry;
     }
 
-  if (err)
-    node_entries_free (node_dirent_list);
-  else
-    *dirents = node_dirent_list;
+  return NULL;
+}
 
-  return err;
+/* Check the information cached about the entries of DIR, which must
+   be locked, for NAME.  Return ENOENT if NAME is known not to exist
+   beneath DIR, zero otherwise.  In the latter case, store the index
+   of the first underlying filesystem known to contain NAME, or zero,
+   in *LAYER, and the generation of the cached information in *GEN,
+   which must be passed to node_lookup_cache_enter once NAME has been
+   looked up.  */
+error_t
+node_lookup_cached (node_t *dir, char *name, int *layer, int *gen)
+{
+  struct netnode *nn = dir->nn;
+  node_dirent_t *entry;
+  struct node_name *slot;
+  unsigned int hash;
+  size_t len;
+
+  *layer = 0;
+
+  if (node_cache_validate (dir) || ! nn->stamps_num)
+    {
+      /* Nothing cached can be trusted; make sure the result is not
+	 remembered either.  */
+      *gen = nn->cache_gen - 1;
+      return 0;
+    }
+
+  *gen = nn->cache_gen;
+  hash = name_hash (name, &len);
+
+  /* A complete listing answers the lookup without any RPCs.  */
+  if (nn->dirents && nn->dirents->complete)
+    {
+      entry = node_dirents_find (nn->dirents, name, hash, len);
+      if (! entry)
+	return ENOENT;
+
+      *layer = entry->layer;
+      return 0;
+    }
+
+  if (nn->names)
+    {
+      slot = nn->names->table + (hash & (NAME_CACHE_SIZE - 1));
+      if (slot->name && slot->hash == hash && ! strcmp (slot->name, name))
+	{
+	  if (slot->layer < 0)
+	    return ENOENT;
+	  *layer = slot->layer;
+	}
+    }
+
+  return 0;
 }
 
-/* Free DIRENTS.  */
+/* Remember the result ERR of looking up NAME beneath DIR, which must
+   be locked, on the underlying filesystem with the index LAYER,
+   unless the cached information has changed since it had the
+   generation GEN.  */
 void
-node_entries_free (node_dirent_t *dirents)
+node_lookup_cache_enter (node_t *dir, char *name, int gen, error_t err,
+			 int layer)
 {
-  node_dirent_t *dirent, *dirent_next;
+  struct netnode *nn = dir->nn;
+  struct node_name *slot;
+  unsigned int hash;
+  size_t len;
+
+  /* A complete listing already knows about all names.  Other errors
+     than ENOENT may depend on the user.  */
+  if ((err && err != ENOENT) || gen != nn->cache_gen || ! nn->stamps_num
+      || (nn->dirents && nn->dirents->complete))
+    return;
+
+  if (! nn->names)
+    {
+      nn->names = calloc (1, sizeof (node_names_t));
+      if (! nn->names)
+	return;
+      node_memory_update (dir);
+    }
 
-  for (dirent = dirents; dirent; dirent = dirent_next)
+  hash = name_hash (name, &len);
+  slot = nn->names->table + (hash & (NAME_CACHE_SIZE - 1));
+  if (! slot->name || slot->hash != hash || strcmp (slot->name, name))
     {
-      dirent_next = dirent->next;
-      free (dirent->dirent);
-      free (dirent);
+      char *copy = strdup (name);
+
+      if (! copy)
+	return;
+      free (slot->name);
+      slot->hash = hash;
+      slot->name = copy;
     }
+  slot->layer = err ? -1 : layer;
+}
+
+/* Free NAMES.  */
+static void
+node_names_free (node_names_t *names)
+{
+  int i;
+
+  for (i = 0; i < NAME_CACHE_SIZE; i++)
+    free (names->table[i].name);
+  free (names);
+}
+
+/* Drop the merged directory listing and all other information about
+   its entries cached in NODE, which must be locked.  */
+void
+node_entries_invalidate (node_t *node)
+{
+  if (node->nn->dirents)
+    node_entries_free (node->nn->dirents);
+  if (node->nn->names)
+    node_names_free (node->nn->names);
+  free (node->nn->stamps);
+  node->nn->dirents = NULL;
+  node->nn->names = NULL;
+  node->nn->stamps = NULL;
+  node->nn->stamps_num = 0;
+  node->nn->cache_gen++;
+  node_memory_update (node);
+}
+
+/* Free DIRENTS.  */
+void
+node_entries_free (node_dirents_t *dirents)
+{
+  free (dirents->table);
+  free (dirents->entries);
+  free (dirents->data);
+  free (dirents);
 }
 
 /* Create the root node (and it's according lnode) and store it in
@@ -506,50 +1553,101 @@ node_create_root (node_t **root_node)
 }
 
 /* Initialize the ports to the underlying filesystems for the root
-   node.  */
+   node.  Ports to filesystems the root node already has are kept, only
+   those which have been registered since are opened.  */
 
 error_t
 node_init_root (node_t *node)
 {
-  error_t err;
+  node_ulfs_t *ulfs_new, **sorted = NULL;
+  unsigned int ulfs_id = 0, gen;
+  node_ports_t *root;
+  error_t err = 0;
   ulfs_t *ulfs;
-  int i = 0;
-
-  mutex_lock (&ulfs_lock);
-
-  err = node_ulfs_init (node);
+  int i, num;
+
+  /* The ports the root node already has are taken from the published
+     snapshot, which holds its own send rights, so that the node itself
+     is only touched while it is locked, below.  */
+  root = node_root_ports_get ();
+  if (root)
+    err = node_ulfs_sort (root->ulfs, root->num, &sorted);
   if (err)
     {
-      mutex_unlock (&ulfs_lock);
+      node_ports_release (root);
       return err;
     }
 
-  node_ulfs_iterate_unlocked (node)
-    {
+  mutex_lock (&ulfs_lock);
 
-      if (err)
-	break;
+  num = ulfs_num;
+  gen = ulfs_gen;
+  ulfs_new = malloc (num * sizeof (node_ulfs_t));
+  if (num && ! ulfs_new)
+    err = ENOMEM;
+
+  for (i = 0; ! err && i < num; i++)
+    {
+      node_ulfs_t *found = NULL;
+      file_t port;
 
       err = ulfs_get_num (i, &ulfs);
       if (err)
-	  break;
+	break;
 
-      if (ulfs->path)
-	node_ulfs->port = file_name_lookup (ulfs->path,
-					    O_READ | O_DIRECTORY, 0);
+      if (root && ulfs->path)
+	found = node_ulfs_find (sorted, root->num, ulfs->id);
+      if (! ulfs->path)
+	port = underlying_node;
+      else if (found && port_valid (found->port))
+	{
+	  port = found->port;
+	  mach_port_mod_refs (mach_task_self (), port,
+			      MACH_PORT_RIGHT_SEND, 1);
+	}
       else
-	node_ulfs->port = underlying_node;
-	  
-      if (! port_valid (node_ulfs->port))
+	port = file_name_lookup (ulfs->path, O_READ | O_DIRECTORY, 0);
+
+      if (! port_valid (port))
 	{
 	  err = errno;
 	  break;
 	}
 
-      node_ulfs->flags |= FLAG_NODE_ULFS_FIXED;
-      i++;
+      ulfs_new[i].port = port;
+      ulfs_new[i].flags = FLAG_NODE_ULFS_FIXED;
+      if (ulfs->flags & FLAG_ULFS_WRITABLE)
+	ulfs_new[i].flags |= FLAG_NODE_ULFS_WRITABLE;
+      ulfs_new[i].id = ulfs->id;
+      if (ulfs->id > ulfs_id)
+	ulfs_id = ulfs->id;
     }
 
   mutex_unlock (&ulfs_lock);
+
+  free (sorted);
+  if (root)
+    node_ports_release (root);
+
+  if (err)
+    {
+      /* Give back the ports acquired so far; the root node keeps the
+	 ones it had.  */
+      while (i-- > 0)
+	if (ulfs_new[i].port != underlying_node)
+	  port_dealloc (ulfs_new[i].port);
+      free (ulfs_new);
+      return err;
+    }
+
+  /* The ports to filesystems which have been removed are
+     deallocated.  */
+  mutex_lock (&node->lock);
+  node_ulfs_set (node, ulfs_new, num);
+  node->nn->update_ulfs_gen = gen;
+  node->nn->update_ulfs_id = ulfs_id;
+  err = node_root_ports_publish (node);
+  mutex_unlock (&node->lock);
+
   return err;
 }
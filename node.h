@@ -37,13 +37,36 @@ struct node_ulfs
 				   underlying filesystem.  */
   file_t port;			/* A port to the underlying
 				   filesystem.  */
+  unsigned int id;		/* The ID of the underlying
+				   filesystem.  */
 };
 typedef struct node_ulfs node_ulfs_t;
 
+/* A snapshot of the ports to the underlying filesystems of a node,
+   see node_ports_make.  */
+typedef struct node_ports node_ports_t;
+
 /* Flags.  */
 
 /* The according port should not be updated.  */
 #define FLAG_NODE_ULFS_FIXED 0x00000001
+/* The underlying filesystem is writable.  */
+#define FLAG_NODE_ULFS_WRITABLE 0x00000002
+
+/* The state of an underlying directory at the time information about
+   it was cached.  Cached information is valid as long as the stamps
+   of all underlying directories stay the same.  */
+struct node_stamp
+{
+  int valid;			/* Non-zero if the directory exists on
+				   this filesystem.  */
+  ino_t ino;
+  fsid_t fsid;
+  off_t size;
+  time_t mtime;
+  time_t ctime;
+};
+typedef struct node_stamp node_stamp_t;
 
 struct netnode
 {
@@ -51,23 +74,114 @@ struct netnode
 				   node.  */
   int flags;			/* Associated flags.  */
   node_ulfs_t *ulfs;		/* Array holding data for each
-				   underlying filesystem.  */
+				   underlying filesystem the node
+				   exists on, in priority order.  */
   int ulfs_num;			/* Number of entries in ULFS.  */
+  time_t update_time;		/* Time the ports in ULFS were last
+				   looked up.  */
+  unsigned int update_ulfs_gen;	/* Value of ULFS_GEN for the set
+				   of underlying filesystems ULFS
+				   follows.  */
+  unsigned int update_ulfs_id;	/* The highest ID of the underlying
+				   filesystems in that set.  */
+  struct node_dirents *dirents;	/* The cached merged directory
+				   listing, or NULL.  */
+  struct node_names *names;	/* Cached results of looking up
+				   names beneath this directory, or
+				   NULL.  */
+  node_stamp_t *stamps;		/* Stamps of the underlying
+				   directories DIRENTS and NAMES
+				   were read from.  */
+  int stamps_num;		/* Number of entries in STAMPS, zero
+				   if they cannot be trusted.  */
+  time_t stamps_time;		/* Time STAMPS were last found
+				   uptodate.  */
+  int cache_gen;		/* Changed whenever the cached
+				   information is dropped.  */
+  ino_t dir_ino;			/* The inode number reported for the
+				   directory the node was last looked
+				   up in, or zero.  */
+  fsid_t ino_fsid;		/* The underlying fsid the node was
+				   last stat'ed on.  */
+  int ino_fsid_index;		/* The index of INO_FSID in the table
+				   of known filesystems, or -1.  */
+  size_t memory;			/* Approximate number of bytes used
+				   by the node and the information
+				   cached in it.  */
   node_t *ncache_next;
   node_t *ncache_prev;
+  int ncache_referenced;	/* Set when the node is looked up
+				   while cached, without holding the
+				   lock of the cache; see
+				   ncache_node_add.  */
+  int ncache_list;		/* The list of the cache the node is
+				   in.  */
+  size_t ncache_memory;		/* MEMORY as last accounted for by
+				   the cache.  */
 };
 typedef struct netnode netnode_t;
 
 /* Flags.  */
-#define FLAG_NODE_INVALIDATE    0x00000001
 #define FLAG_NODE_ULFS_UPTODATE 0x00000002
 
+/* An entry of a merged directory listing.  */
 typedef struct node_dirent
 {
-  struct dirent *dirent;
-  struct node_dirent *next;
+  size_t offset;		/* Offset of the dirent record within
+				   the arena of the listing.  */
+  unsigned int hash;		/* Hash value of the entry's name.  */
+  int layer;			/* Index of the first underlying
+				   filesystem containing the entry,
+				   which D_FILENO and D_TYPE are taken
+				   from.  */
+  int seq;			/* Position of the entry in the
+				   directory of that filesystem.  */
 } node_dirent_t;
 
+/* A merged directory listing.  The dirent records are stored back to
+   back in a single arena, in the order of the entries; names are
+   deduplicated through an open addressing hash table.  */
+typedef struct node_dirents
+{
+  char *data;			/* The arena holding the dirent
+				   records.  */
+  size_t data_size;		/* Number of bytes used in DATA; this
+				   is also the size of the merged
+				   directory.  */
+  size_t data_alloced;		/* Number of bytes allocated for
+				   DATA.  */
+  node_dirent_t *entries;	/* The entries, ordered by the first
+				   underlying filesystem containing
+				   them and their position in it.  */
+  int num;			/* Number of entries.  */
+  int alloced;			/* Number of allocated ENTRIES.  */
+  int *table;			/* Hash table holding indices into
+				   ENTRIES plus one; zero marks a free
+				   slot.  */
+  int table_size;		/* Number of slots in TABLE, always a
+				   power of two.  */
+  int complete;			/* Non-zero if all underlying
+				   directories could be read.  */
+} node_dirents_t;
+
+/* Return the dirent record of the entry ENTRY in DIRENTS.  */
+#define node_dirent_get(dirents, entry) \
+  ((struct dirent *) ((dirents)->data + (entry)->offset))
+
+/* Maximum number of bytes read from an underlying directory at
+   once, may be overwritten by the user.  */
+extern size_t readdir_chunk_size;
+
+/* Number of seconds the information cached about the entries of a
+   directory is used without checking the underlying directories, may
+   be overwritten by the user.  */
+extern int cache_timeout;
+
+/* Number of seconds the ports to the underlying directories of a
+   node are used without looking them up again, may be overwritten by
+   the user.  */
+extern int port_timeout;
+
 /* Create a new node, derived from a light node, add a reference to
    the light node.  */
 error_t node_create (lnode_t *lnode, node_t **node);
@@ -77,9 +191,26 @@ error_t node_create (lnode_t *lnode, node_t **node);
 void node_destroy (node_t *node);
 
 /* Make sure that all ports to the underlying filesystems of NODE,
-   which must be locked, are uptodate.  */
+   which must be locked, are uptodate.  Ports which have timed out are
+   looked up beneath the ports of the parent of NODE, which is locked
+   meanwhile instead of NODE; no light node may be locked by the
+   caller.  */
 error_t node_update (node_t *node);
 
+/* Look up the ports to the underlying filesystems of NODE beneath the
+   ports of its parent DIR, which must be uptodate.  DIR, its light
+   node and NODE must be locked; they are all unlocked while the
+   underlying filesystems are asked and locked again before
+   returning.  Return the error of the lookup on the first filesystem
+   on which it did not fail with ENOENT; on success, store the
+   according stat information in *STAT.  */
+error_t node_update_under (node_t *node, node_t *dir, struct stat *stat);
+
+/* Return non-zero if the ports to the underlying filesystems of
+   NODE, which must be locked, have been looked up recently enough to
+   be used without looking them up again.  */
+int node_update_fresh (node_t *node);
+
 /* Create a directory named NAME beneath DIR on all the (writable) underlying
    filesystems.  */
 error_t node_dir_create (node_t *dir, char *name, mode_t mode);
@@ -92,22 +223,71 @@ error_t node_dir_remove (node_t *dir, char *name);
    with FLAGS as openflags.  */
 error_t node_unlink_file (node_t *dir, char *name);
 
-/* Lookup a file named NAME beneath DIR on the underlying filesystems
-   with FLAGS as openflags.  Return the first port successfully looked
-   up in *PORT and according stat information in *STAT.  */
+/* Lookup a file named NAME beneath DIR, which must be locked, on the
+   underlying filesystems with FLAGS as openflags.  Return the first
+   port successfully looked up in *PORT and according stat
+   information in *STAT.  */
 error_t node_lookup_file (node_t *dir, char *name, int flags,
 			  file_t *port, struct stat *stat);
 
-/* Initialize per-ulfs data structures for NODE.  The ulfs_lock must
-   be held by the caller.  */
-error_t node_ulfs_init (node_t *node);
+/* Store a new snapshot of the ports of NODE, which must be locked,
+   holding one reference in *PORTS.  The snapshot holds its own send
+   rights and stays usable after NODE is unlocked.  */
+error_t node_ports_make (node_t *node, node_ports_t **ports);
+
+/* Remove a reference from the snapshot PORTS, freeing it if that was
+   the last one.  */
+void node_ports_release (node_ports_t *ports);
+
+/* Like node_lookup_file, but look up NAME beneath the directories in
+   the snapshot PORTS, so that the directory need not be locked, and
+   first try the underlying filesystem with the index *LAYER, which is
+   known to be the first one containing NAME; only if NAME does not
+   exist there, try all of them.  On success, store the index of the
+   filesystem *PORT belongs to in *LAYER.  */
+error_t node_lookup_file_layer (node_ports_t *ports, char *name,
+				int flags, int *layer, file_t *port,
+				struct stat *stat);
+
+/* Check the information cached about the entries of DIR, which must
+   be locked, for NAME.  Return ENOENT if NAME is known not to exist
+   beneath DIR, zero otherwise.  In the latter case, store the index
+   of the first underlying filesystem known to contain NAME, or zero,
+   in *LAYER, and the generation of the cached information in *GEN,
+   which must be passed to node_lookup_cache_enter once NAME has been
+   looked up.  */
+error_t node_lookup_cached (node_t *dir, char *name, int *layer,
+			    int *gen);
+
+/* Remember the result ERR of looking up NAME beneath DIR, which must
+   be locked, on the underlying filesystem with the index LAYER,
+   unless the cached information has changed since it had the
+   generation GEN.  */
+void node_lookup_cache_enter (node_t *dir, char *name, int gen,
+			      error_t err, int layer);
+
+/* Store the merged directory entries of NODE, which must be locked,
+   in *DIRENTS.  The listing is cached in NODE and only read again
+   when one of the underlying directories has changed; it belongs to
+   NODE and stays valid until NODE is unlocked.  */
+error_t node_entries_get (node_t *node, node_dirents_t **dirents);
+
+/* Like node_entries_get, but if NODE already caches a listing,
+   return it without checking the underlying directories.  This keeps
+   the entry numbers stable while a client reads a directory in
+   several chunks, as long as the cached listing is not replaced
+   meanwhile; it is not tied to the client, so a read from the first
+   entry seeing changes, or the listing being dropped, makes the
+   remaining chunks come from the new listing, which may skip or
+   repeat entries.  */
+error_t node_entries_snapshot (node_t *node, node_dirents_t **dirents);
 
-/* Read the merged directory entries from NODE, which must be
-   locked, into *DIRENTS.  */
-error_t node_entries_get (node_t *node, node_dirent_t **dirents);
+/* Drop the merged directory listing and all other information about
+   its entries cached in NODE, which must be locked.  */
+void node_entries_invalidate (node_t *node);
 
 /* Free DIRENTS.  */
-void node_entries_free (node_dirent_t *dirents);
+void node_entries_free (node_dirents_t *dirents);
 
 /* Create the root node (and it's according lnode) and store it in
    *ROOT_NODE.  */
@@ -33,6 +33,7 @@
 #include "pattern.h"
 #include "stow.h"
 #include "update.h"
+#include "pool.h"
 
 /* This variable is set to a non-zero value after parsing of the
    startup options.  Whenever the argument parser is later called to
@@ -51,6 +52,27 @@ static const struct argp_option argp_common_options[] =
       "send debugging messages to stderr" },
     { OPT_LONG_CACHE_SIZE, OPT_CACHE_SIZE, "SIZE", 0,
       "specify the maximum number of nodes in the cache" },
+    { OPT_LONG_CACHE_MEMORY, OPT_CACHE_MEMORY, "BYTES", 0,
+      "specify the maximum number of bytes used by the nodes in the"
+      " cache, 0 for no limit" },
+    { OPT_LONG_READDIR_CHUNK, OPT_READDIR_CHUNK, "SIZE", 0,
+      "read underlying directories in chunks of at most SIZE bytes" },
+    { OPT_LONG_CACHE_TIMEOUT, OPT_CACHE_TIMEOUT, "SECS", 0,
+      "check underlying directories for changes at most every SECS"
+      " seconds; files created or removed directly in an underlying"
+      " filesystem may stay unnoticed for that long (default: 0, check"
+      " on every lookup)" },
+    { OPT_LONG_PORT_TIMEOUT, OPT_PORT_TIMEOUT, "SECS", 0,
+      "look up the underlying directories of a directory again at most"
+      " every SECS seconds; directories created directly in an"
+      " underlying filesystem may stay hidden for that long"
+      " (default: 1)" },
+    { OPT_LONG_UPDATE_DELAY, OPT_UPDATE_DELAY, "MSECS", 0,
+      "wait MSECS milliseconds for further changes of the underlying"
+      " filesystems before applying them" },
+    { OPT_LONG_UPDATE_DELAY_MAX, OPT_UPDATE_DELAY_MAX, "MSECS", 0,
+      "apply changes of the underlying filesystems after at most MSECS"
+      " milliseconds" },
     { 0, 0, 0, 0, "Runtime options:", 1 },
     { OPT_LONG_STOW, OPT_STOW, "STOWDIR", 0,
       "stow given directory", 1},
@@ -68,6 +90,9 @@ static const struct argp_option argp_common_options[] =
 /* Argp options only meaningful for startup parsing.  */
 static const struct argp_option argp_startup_options[] =
   {
+    { OPT_LONG_THREADS, OPT_THREADS, "NUM", 0,
+      "use NUM threads for accessing the underlying filesystems"
+      " in parallel" },
     { 0 }
   };
 
@@ -102,6 +127,34 @@ argp_parse_common_options (int key, char *arg, struct argp_state *state)
       ncache_size = strtol (arg, NULL, 10);
       break;
 
+    case OPT_CACHE_MEMORY:	/* --cache-memory  */
+      ncache_memory = strtoul (arg, NULL, 10);
+      break;
+
+    case OPT_READDIR_CHUNK:	/* --readdir-chunk  */
+      readdir_chunk_size = strtol (arg, NULL, 10);
+      /* A chunk must at least hold an entry with the longest possible
+	 name.  */
+      if (readdir_chunk_size < DIRENT_LEN (255))
+	readdir_chunk_size = DIRENT_LEN (255);
+      break;
+
+    case OPT_CACHE_TIMEOUT:	/* --cache-timeout  */
+      cache_timeout = strtol (arg, NULL, 10);
+      break;
+
+    case OPT_PORT_TIMEOUT:	/* --port-timeout  */
+      port_timeout = strtol (arg, NULL, 10);
+      break;
+
+    case OPT_UPDATE_DELAY:	/* --update-delay  */
+      update_delay = strtol (arg, NULL, 10);
+      break;
+
+    case OPT_UPDATE_DELAY_MAX:	/* --update-delay-max  */
+      update_delay_max = strtol (arg, NULL, 10);
+      break;
+
     case OPT_ADD:		/* --add */
       ulfs_mode = ULFS_MODE_ADD;
       break;
@@ -150,10 +203,6 @@ argp_parse_common_options (int key, char *arg, struct argp_state *state)
 	{
 	  root_update_schedule ();
 	}
-      else
-	{
-	  ncache_reset ();
-	}
       ulfs_modified = 0;
 
       if (! parsing_startup_options_finished)
@@ -176,6 +225,10 @@ argp_parse_startup_options (int key, char *arg, struct argp_state *state)
 
   switch (key)
     {
+    case OPT_THREADS:		/* --threads  */
+      pool_threads = strtol (arg, NULL, 10);
+      break;
+
     default:
       err = ARGP_ERR_UNKNOWN;
       break;
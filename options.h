@@ -29,6 +29,13 @@
 #define OPT_PATTERN    'm'
 #define OPT_PRIORITY   'p'
 #define OPT_STOW       's'
+#define OPT_READDIR_CHUNK 'k'
+#define OPT_THREADS    't'
+#define OPT_CACHE_TIMEOUT 'T'
+#define OPT_PORT_TIMEOUT 'P'
+#define OPT_CACHE_MEMORY 'M'
+#define OPT_UPDATE_DELAY 'D'
+#define OPT_UPDATE_DELAY_MAX 'L'
 
 /* The long options.  */
 #define OPT_LONG_UNDERLYING "underlying"
@@ -40,6 +47,13 @@
 #define OPT_LONG_PATTERN    "match"
 #define OPT_LONG_PRIORITY   "priority"
 #define OPT_LONG_STOW       "stow"
+#define OPT_LONG_READDIR_CHUNK "readdir-chunk"
+#define OPT_LONG_THREADS    "threads"
+#define OPT_LONG_CACHE_TIMEOUT "cache-timeout"
+#define OPT_LONG_PORT_TIMEOUT "port-timeout"
+#define OPT_LONG_CACHE_MEMORY "cache-memory"
+#define OPT_LONG_UPDATE_DELAY "update-delay"
+#define OPT_LONG_UPDATE_DELAY_MAX "update-delay-max"
 
 #define OPT_LONG(o) "--" o
 
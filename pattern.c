@@ -24,11 +24,130 @@
 #include <hurd/netfs.h>
 #include <stdlib.h>
 #include <fnmatch.h>
+#include <string.h>
 #include <errno.h>
 
 #include "pattern.h"
 
-/* Add a wildcard expression *PATTERN to **PATTERNLIST.  */
+/* Initial number of slots of the wildcards of a trie node.  */
+#define PATTERN_WILDCARDS_SIZE 4
+
+/* The trie is changed by threads holding the lock of the list, while
+   others walk it without the lock.  Anything a pointer leads to is
+   set up before the pointer is stored.  */
+#define pattern_load(p) __atomic_load_n (&(p), __ATOMIC_ACQUIRE)
+#define pattern_store(p, v) __atomic_store_n (&(p), (v), __ATOMIC_RELEASE)
+
+/* Return the node for the child of NODE continuing it with C;
+   create it if CREATE is nonzero and there is none yet.  Creating
+   requires the lock of the list.  */
+static struct pattern_node *
+pattern_node_child (struct pattern_node *node, unsigned char c, int create)
+{
+  struct pattern_node *child;
+
+  for (child = pattern_load (node->child); child; child = child->sibling)
+    if (child->c == c)
+      return child;
+
+  if (! create)
+    return NULL;
+
+  child = calloc (1, sizeof (struct pattern_node));
+  if (child)
+    {
+      child->c = c;
+      child->sibling = node->child;
+      pattern_store (node->child, child);
+    }
+  return child;
+}
+
+/* Free the children of NODE and everything they refer to.  */
+static void
+pattern_node_free (struct pattern_node *node)
+{
+  struct pattern_node *child, *next;
+  struct pattern_wildcards *w, *old;
+
+  for (child = node->child; child; child = next)
+    {
+      next = child->sibling;
+      pattern_node_free (child);
+      free (child);
+    }
+  for (w = node->wildcards; w; w = old)
+    {
+      old = w->old;
+      free (w);
+    }
+  node->child = NULL;
+  node->wildcards = NULL;
+}
+
+/* Add the wildcard pattern P to the wildcards of NODE.  The lock of
+   the list must be held.  */
+static error_t
+pattern_node_add_wildcard (struct pattern_node *node, char *p)
+{
+  struct pattern_wildcards *w = node->wildcards, *w_new;
+  int size;
+
+  /* One slot is always left for the terminating NULL.  */
+  if (w && w->num + 1 < w->size)
+    {
+      pattern_store (w->wildcards[w->num], p);
+      w->num++;
+      return 0;
+    }
+
+  size = w ? w->size * 2 : PATTERN_WILDCARDS_SIZE;
+  w_new = calloc (1, sizeof (struct pattern_wildcards)
+		  + size * sizeof (char *));
+  if (! w_new)
+    return ENOMEM;
+
+  w_new->old = w;
+  w_new->size = size;
+  if (w)
+    {
+      memcpy (w_new->wildcards, w->wildcards, w->num * sizeof (char *));
+      w_new->num = w->num;
+    }
+  w_new->wildcards[w_new->num++] = p;
+  pattern_store (node->wildcards, w_new);
+  return 0;
+}
+
+/* Add PATTERN to the trie below ROOT.  The lock of the list must be
+   held.  */
+static error_t
+pattern_node_add (struct pattern_node *root, char *pattern)
+{
+  struct pattern_node *node = root;
+  char *p;
+
+  /* Follow the literal prefix of PATTERN.  */
+  for (p = pattern; *p && ! strchr ("*?[\\", *p); p++)
+    {
+      node = pattern_node_child (node, *p, 1);
+      if (! node)
+	return ENOMEM;
+    }
+
+  if (! *p)
+    pattern_store (node->literal, 1);
+  else if (! strcmp (p, "*"))
+    pattern_store (node->prefix, 1);
+  else
+    return pattern_node_add_wildcard (node, p);
+
+  return 0;
+}
+
+/* Add a wildcard expression *PATTERN to **PATTERNLIST.  The pattern
+   is compiled into the trie of the list right away; nodes left behind
+   in the trie if that fails match nothing.  */
 error_t
 patternlist_add (struct patternlist *list, char *pattern)
 {
@@ -54,52 +173,75 @@ patternlist_add (struct patternlist *list, char *pattern)
     err = ENOMEM;
 
   if (err)
+    {
+      free (dup);
       return err;
+    }
 
   listentry->pattern = dup;
 
   mutex_lock (& (list->lock));
-  if (list->head == NULL) /* List is empty.  */
-    {
-      list->head = listentry;
-      listentry->next = NULL;
-    }
-  else
+  err = pattern_node_add (&list->root, dup);
+  if (! err)
     {
       listentry->next = list->head;
       list->head = listentry;
     }
   mutex_unlock (& (list->lock));
 
+  if (err)
+    {
+      free (dup);
+      free (listentry);
+    }
+
   return err;
 }
 
 /* Check for match all pattern of the list *LIST, returning logical OR
-   of results.  */
+   of results.  The literal prefixes of the patterns are matched all at
+   once by walking the trie of the list; only the remainders of the
+   patterns starting with the part of STRING walked so far are handed
+   to fnmatch.  No lock is taken; patterns added meanwhile may or may
+   not be seen.  */
 int
 patternlist_match (struct patternlist *list, char *string)
 {
-  struct pattern *ptr;
-  error_t err = ~0; /* Return false by default */
+  struct pattern_wildcards *w;
+  struct pattern_node *node;
+  int err = FNM_NOMATCH;
+  int slash;
+  char *s, *p;
+  int i;
 
-  ptr = list->head;
+  slash = (strchr (string, '/') != NULL);
 
-  mutex_lock (&list->lock);
-  while (ptr != NULL)
+  for (node = &list->root, s = string;
+       err && node;
+       node = pattern_node_child (node, *s++, 0))
     {
-      err = fnmatch (ptr->pattern, string, FNM_FILE_NAME);
+      /* The wildcard does not match a slash.  */
+      if (pattern_load (node->prefix) && ! (slash && strchr (s, '/')))
+	err = 0;
 
-      if (!err) /* String matched.  */
-	break;
+      w = pattern_load (node->wildcards);
+      for (i = 0; err && w && (p = pattern_load (w->wildcards[i])); i++)
+	if (! fnmatch (p, s, FNM_FILE_NAME))
+	  err = 0;
 
-      ptr = ptr->next;
+      if (err && ! *s)
+	{
+	  if (pattern_load (node->literal))
+	    err = 0;
+	  break;
+	}
     }
-  mutex_unlock (&list->lock);
 
   return err;
 }
 
-/* Free all resource used by *PATTERNLIST.  */
+/* Free all resource used by *PATTERNLIST; no thread may be matching
+   against it.  */
 void
 patternlist_destroy (struct patternlist *list)
 {
@@ -110,10 +252,16 @@ patternlist_destroy (struct patternlist *list)
     {
       next = ptr->next;
 
+      free (ptr->pattern);
       free (ptr);
 
       ptr = next;
     }
+  list->head = NULL;
+
+  pattern_node_free (&list->root);
+  list->root.literal = 0;
+  list->root.prefix = 0;
   mutex_unlock (& (list->lock));
 }
 
@@ -31,10 +31,46 @@ struct pattern
   struct pattern *next;
 };
 
+/* The remainders of the patterns starting with the string of a trie
+   node, up to the first wildcard.  The array only grows in place
+   while it has room; a larger copy then replaces it, and the array it
+   replaced is kept until the list is destroyed, as threads might
+   still be reading it.  */
+struct pattern_wildcards
+{
+  struct pattern_wildcards *old; /* The array replaced by this one.  */
+  int size;			/* Number of slots in WILDCARDS.  */
+  int num;			/* Number of patterns in WILDCARDS.  */
+  char *wildcards[];		/* NUM patterns followed by NULL.  */
+};
+
+/* A node of the trie of the literal prefixes of the patterns, standing
+   for the string spelled by the path leading to it.  Nodes are only
+   ever added to the trie and flags only ever set, each in a single
+   store, so that the trie can be walked without holding the lock of
+   the list.  */
+struct pattern_node
+{
+  struct pattern_node *child;	/* The first node continuing this
+				   one.  */
+  struct pattern_node *sibling;	/* The next child of the parent.  */
+  unsigned char c;		/* The last character of the
+				   string.  */
+  int literal;			/* A pattern matches the string.  */
+  int prefix;			/* A pattern matches the string
+				   followed by anything but a
+				   slash.  */
+  struct pattern_wildcards *wildcards; /* The rest of the patterns
+					  starting with the string,
+					  or NULL.  */
+};
+
 struct patternlist
 {
-  struct mutex lock;
+  struct mutex lock;		/* Serializes changes of the list.  */
   struct pattern *head;
+  struct pattern_node root;	/* The trie of the patterns in HEAD,
+				   compiled as they are added.  */
 };
 
 /* Add a wildcard expression *PATTERN to **PATTERNLIST.  */
@@ -44,7 +80,8 @@ extern error_t patternlist_add (struct patternlist *list, char *pattern);
    of results.  */
 extern int patternlist_match (struct patternlist *list, char *string);
 
-/* Free all resource used by *PATTERNLIST */
+/* Free all resource used by *PATTERNLIST; no thread may be matching
+   against it.  */
 extern void patternlist_destroy (struct patternlist *list);
 
 /* Return nonzero if *PATTERNLIST is empty */
@@ -0,0 +1,169 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+ 
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+ 
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Worker threads for issuing requests to the underlying filesystems
+   in parallel.  */
+
+#define _GNU_SOURCE
+
+#include <hurd/netfs.h>
+#include <error.h>
+#include <cthreads.h>
+
+#include "pool.h"
+#include "unionfs.h"
+
+/* A set of calls handed to pool_run.  */
+struct pool_job
+{
+  void (*func) (int, void *);
+  void *priv;
+  int num;			/* Number of calls.  */
+  int started;			/* Number of calls started so far.  */
+  int finished;			/* Number of calls finished so far.  */
+  struct condition done;	/* Signalled when all calls have
+				   finished.  */
+  struct pool_job *next, **prevp; /* Jobs with calls left to start are
+				     queued in a list.  */
+};
+
+/* Number of worker threads, may be overwritten by the user.  */
+int pool_threads = POOL_THREADS;
+
+/* The lock protecting the job queue and the jobs in it.  */
+static struct mutex pool_lock = MUTEX_INITIALIZER;
+
+/* Signalled when a job is queued.  */
+static struct condition pool_wakeup = CONDITION_INITIALIZER;
+
+/* The queue of jobs with calls left to start.  */
+static struct pool_job *pool_queue;
+static struct pool_job **pool_queue_end = &pool_queue;
+
+/* Number of worker threads running.  */
+static int pool_workers;
+
+/* Start the next call of JOB and wait for it to finish.  POOL_LOCK
+   must be held; it is released during the call.  */
+static void
+pool_job_step (struct pool_job *job)
+{
+  int i = job->started++;
+
+  if (job->started == job->num)
+    {
+      /* This was the last call to start, dequeue JOB.  */
+      *job->prevp = job->next;
+      if (job->next)
+	job->next->prevp = job->prevp;
+      else
+	pool_queue_end = job->prevp;
+    }
+
+  mutex_unlock (&pool_lock);
+  (*job->func) (i, job->priv);
+  mutex_lock (&pool_lock);
+
+  if (++job->finished == job->num)
+    condition_broadcast (&job->done);
+}
+
+/* The worker threads; surplus ones exit.  */
+static void
+_pool_worker_thread ()
+{
+  mutex_lock (&pool_lock);
+  while (pool_workers <= pool_threads)
+    {
+      if (pool_queue)
+	pool_job_step (pool_queue);
+      else
+	condition_wait (&pool_wakeup, &pool_lock);
+    }
+  pool_workers--;
+  mutex_unlock (&pool_lock);
+}
+
+/* Start or stop worker threads, so that POOL_THREADS of them are
+   running; POOL_THREADS may change while the startup options are
+   parsed.  POOL_LOCK must be held.  */
+static void
+pool_start (void)
+{
+  for (; pool_workers < pool_threads; pool_workers++)
+    cthread_detach (cthread_fork ((cthread_fn_t) _pool_worker_thread, 0));
+
+  if (pool_workers > pool_threads)
+    condition_broadcast (&pool_wakeup);
+}
+
+/* Make sure that POOL_THREADS worker threads are running.  */
+error_t
+pool_init (void)
+{
+  mutex_lock (&pool_lock);
+  pool_start ();
+  mutex_unlock (&pool_lock);
+
+  return 0;
+}
+
+/* Call FUNC (I, PRIV) for each I from 0 to NUM - 1.  The calls are
+   spread over the worker threads and the calling thread; return when
+   all of them have finished.  */
+void
+pool_run (int num, void (*func) (int, void *), void *priv)
+{
+  struct pool_job job;
+  int i;
+
+  if (pool_threads <= 0 || num <= 1)
+    {
+      for (i = 0; i < num; i++)
+	(*func) (i, priv);
+      return;
+    }
+
+  job.func = func;
+  job.priv = priv;
+  job.num = num;
+  job.started = 0;
+  job.finished = 0;
+  condition_init (&job.done);
+
+  mutex_lock (&pool_lock);
+
+  /* Jobs may already be run while the startup options are parsed,
+     before --threads has been seen.  */
+  pool_start ();
+
+  job.next = NULL;
+  job.prevp = pool_queue_end;
+  *pool_queue_end = &job;
+  pool_queue_end = &job.next;
+  condition_broadcast (&pool_wakeup);
+
+  /* Help with our own job instead of only waiting for it.  */
+  while (job.started < job.num)
+    pool_job_step (&job);
+
+  while (job.finished < job.num)
+    condition_wait (&job.done, &pool_lock);
+
+  mutex_unlock (&pool_lock);
+}
@@ -0,0 +1,39 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+ 
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+ 
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Worker threads for issuing requests to the underlying filesystems
+   in parallel.  */
+
+#ifndef INCLUDED_POOL_H
+#define INCLUDED_POOL_H
+
+#include <hurd/netfs.h>
+#include <error.h>
+
+/* Number of worker threads, may be overwritten by the user.  */
+extern int pool_threads;
+
+/* Make sure that POOL_THREADS worker threads are running.  */
+error_t pool_init (void);
+
+/* Call FUNC (I, PRIV) for each I from 0 to NUM - 1.  The calls are
+   spread over the worker threads and the calling thread; return when
+   all of them have finished.  */
+void pool_run (int num, void (*func) (int, void *), void *priv);
+
+#endif
@@ -23,19 +23,38 @@
 #define _GNU_SOURCE
 
 #include <argp.h>
+#include <argz.h>
 #include <error.h>
 
 #include "ulfs.h"
 #include "lib.h"
 #include "pattern.h"
 #include "update.h"
+#include "pool.h"
 
 struct stow_privdata
 {
   struct patternlist *patternlist;
   int flags;
   int priority;
-  struct mutex lock;
+};
+
+/* A package of a stow directory and the underlying filesystems found
+   in it.  */
+struct stow_package
+{
+  char *name;
+  char *paths;			/* Argz vector of the filesystems.  */
+  size_t paths_len;
+  error_t err;
+};
+
+/* A scan of packages of the stow directory DIRPATH.  */
+struct stow_scan
+{
+  struct stow_privdata *privdata;
+  char *dirpath;
+  struct stow_package *packages;
 };
 
 static error_t
@@ -44,70 +63,156 @@ _stow_registermatchingdirs (char *arg, char *dirpath, void *priv)
   error_t err = 0;
   char *filepath;
 
-  struct stow_privdata *privdata = (struct stow_privdata *) priv ;
+  struct stow_scan *scan = (struct stow_scan *) priv;
+  struct stow_package *package = scan->packages;
 
-  err = patternlist_match (privdata->patternlist, arg);
+  err = patternlist_match (scan->privdata->patternlist, arg);
   if (err)
     return 0; /* It doesn't match. This is not an error.  */
 
   filepath = make_filepath (dirpath, arg);
+  if (! filepath)
+    return ENOMEM;
 
-  err = ulfs_register (filepath, privdata->flags, privdata->priority);
+  err = argz_add (&package->paths, &package->paths_len, filepath);
 
   free (filepath);
 
-  if (err)
-    return err;
-  
-  return 0;
+  return err;
 }
 
-static error_t
-_stow_scanstowentry (char *arg, char *dirpath, void *priv)
+/* Collect the underlying filesystems of the I-th package of the scan
+   PRIV.  */
+static void
+_stow_scanpackage (int i, void *priv)
 {
-  char *filepath = dirpath;
+  struct stow_scan *scan = (struct stow_scan *) priv;
+  struct stow_package *package = scan->packages + i;
+  char *filepath, *tmp;
   error_t err;
 
-  struct stow_privdata *privdata = (struct stow_privdata *) priv ;
+  tmp = make_filepath (scan->dirpath, package->name);
+  filepath = tmp ? make_filepath (tmp, "/") : NULL;
+  free (tmp);
+  if (! filepath)
+    {
+      package->err = ENOMEM;
+      return;
+    }
 
-  if (dirpath) 
+  if (patternlist_isempty (scan->privdata->patternlist))
     {
-      char *tmp;
-      tmp = make_filepath (dirpath, arg);
-      filepath = make_filepath (tmp, "/");
-      free (tmp);
+      /* Only directories are packages; anything else in the stow
+	 directory is skipped.  */
+      err = check_dir (filepath);
+      if (! err)
+	err = argz_add (&package->paths, &package->paths_len, filepath);
+      else if (err == ENOTDIR)
+	err = 0;
     }
+  else
+    {
+      /* The callback only needs this package.  */
+      struct stow_scan package_scan = *scan;
 
-  mutex_lock (&privdata->lock);
+      package_scan.packages = package;
+      err = for_each_subdir_priv (filepath, _stow_registermatchingdirs,
+				  &package_scan);
+    }
 
-  if (patternlist_isempty (privdata->patternlist))
-    {
+  free (filepath);
+  package->err = err;
+}
 
-      err = ulfs_register (filepath, privdata->flags, privdata->priority);
-      if (err)
-	{
-	  mutex_unlock (&privdata->lock);
-	  return err;
-	}
+/* Scan the packages in the argz vector NAMES of the stow directory
+   DIRPATH in parallel and register the underlying filesystems found
+   in them at once.  Packages which cannot be scanned are skipped.  */
+static error_t
+_stow_scanstowentries (char *names, size_t names_len, char *dirpath,
+		       struct stow_privdata *privdata)
+{
+  struct stow_scan scan = { privdata, dirpath, NULL };
+  char **paths = NULL, *name = NULL;
+  int num, paths_num = 0, i;
+  error_t err = 0;
 
+  num = argz_count (names, names_len);
+  if (! num)
+    return 0;
+
+  scan.packages = calloc (num, sizeof (struct stow_package));
+  if (! scan.packages)
+    return ENOMEM;
+
+  for (i = 0; (name = argz_next (names, names_len, name)); i++)
+    scan.packages[i].name = name;
+
+  pool_run (num, _stow_scanpackage, &scan);
+
+  for (i = 0; i < num; i++)
+    {
+      if (scan.packages[i].err)
+	fprintf (stderr, "unionfs: couldn't scan %s%s: %s\n", dirpath,
+		 scan.packages[i].name, strerror (scan.packages[i].err));
+      paths_num += argz_count (scan.packages[i].paths,
+			       scan.packages[i].paths_len);
     }
-  else
+
+  if (paths_num)
     {
-      err = for_each_subdir_priv (filepath, _stow_registermatchingdirs, priv);
-      if (err)
+      paths = malloc (paths_num * sizeof (char *));
+      if (! paths)
+	err = ENOMEM;
+    }
+
+  if (! err && paths_num)
+    {
+      char **p = paths;
+
+      for (i = 0; i < num; i++)
 	{
-	  mutex_unlock (&privdata->lock);
-	  free (filepath);
-	  return err;
+	  argz_extract (scan.packages[i].paths, scan.packages[i].paths_len,
+			p);
+	  p += argz_count (scan.packages[i].paths,
+			   scan.packages[i].paths_len);
 	}
+
+      err = ulfs_register_many (paths, paths_num, privdata->flags,
+				privdata->priority);
     }
 
-  free (filepath);
-  mutex_unlock (&privdata->lock);
+  free (paths);
+  for (i = 0; i < num; i++)
+    free (scan.packages[i].paths);
+  free (scan.packages);
   return err;
 }
 
-
+/* An argz vector of the names of the packages of a stow
+   directory.  */
+struct stow_names
+{
+  char *argz;
+  size_t argz_len;
+};
+
+/* Add the package ARG to the names PRIV.  */
+static error_t
+_stow_addpackage (char *arg, char *dirpath, void *priv)
+{
+  struct stow_names *names = (struct stow_names *) priv;
+
+  return argz_add (&names->argz, &names->argz_len, arg);
+}
+
+static error_t
+_stow_scanstowentry (char *arg, char *dirpath, void *priv)
+{
+  return _stow_scanstowentries (arg, strlen (arg) + 1, dirpath,
+				(struct stow_privdata *) priv);
+}
+
+
 /* Implement server for fs_notify.  */
 
 #include <cthreads.h>
@@ -215,7 +320,27 @@ stow_S_dir_changed (stow_notify_t notify, natural_t tickno,
       break;
 
     case DIR_CHANGED_UNLINK:
-      root_update_schedule ();
+      {
+	char *tmp, *prefix;
+
+	/* Only the filesystems of the removed package are dropped.  */
+	tmp = make_filepath (notify->dir_name, name);
+	prefix = tmp ? make_filepath (tmp, "/") : NULL;
+	free (tmp);
+	if (! prefix)
+	  return ENOMEM;
+
+	root_update_disable ();
+
+	err = ulfs_unregister_under (prefix);
+	if (! err)
+	  root_update_schedule ();
+	else if (err != ENOENT)
+	  debug_msg_send ("unregister: %s\n", strerror (err));
+
+	root_update_enable ();
+	free (prefix);
+      }
       break;
 
     default:
@@ -260,6 +385,7 @@ stow_diradd (char *dir, int flags, struct patternlist *patternlist,
 
   error_t err;
   struct stow_privdata *mypriv;
+  struct stow_names names = { NULL, 0 };
   int dir_len;
 
   dir_len = strlen(dir);
@@ -294,9 +420,11 @@ stow_diradd (char *dir, int flags, struct patternlist *patternlist,
   mypriv->patternlist = patternlist;
   mypriv->flags = flags;
   mypriv->priority = priority;
-  mutex_init (&mypriv->lock);
   
-  err = for_each_subdir_priv (dir, _stow_scanstowentry, (void *)mypriv);
+  err = for_each_subdir_priv (dir, _stow_addpackage, &names);
+  if (! err)
+    err = _stow_scanstowentries (names.argz, names.argz_len, dir, mypriv);
+  free (names.argz);
   if (err)
     {
       /* FIXME: rescan and delete previous inserted things.  */
@@ -0,0 +1,187 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Measure the throughput of lookups hitting the node cache with an
+   increasing number of threads: once through ncache_node_add, which
+   only marks cached nodes as referenced, and once through the
+   baseline's LRU list, which moved every looked up node to the front
+   under the global lock.  Only the cache is exercised; reference
+   counting and the locks of the nodes are left out, as they are the
+   same in both cases.  The cache is compiled from ncache.c on the
+   host, see shim/hurd/netfs.h.
+
+   Usage: ncache-contention [MAX-THREADS [LOOKUPS-PER-THREAD]]
+
+   The number of threads doubles from 1 up to MAX-THREADS, which is 64
+   by default.  */
+
+#define _GNU_SOURCE
+
+#include "../ncache.c"
+
+#include <stdio.h>
+#include <time.h>
+
+int unionfs_flags;
+struct mutex debug_msg_lock = MUTEX_INITIALIZER;
+
+/* The cache keeps its nodes alive; no node is ever freed here.  */
+void
+netfs_nref (struct node *node)
+{
+  node->references++;
+}
+
+void
+netfs_nrele (struct node *node)
+{
+  node->references--;
+}
+
+error_t
+node_create (lnode_t *lnode, node_t **node)
+{
+  return ENOSYS;
+}
+
+/* Number of nodes looked up, all of them cached.  */
+#define NODES 1024
+
+static node_t nodes[NODES];
+static netnode_t netnodes[NODES];
+static lnode_t lnodes[NODES];
+
+/* The LRU list of the baseline.  */
+static struct mutex lru_lock = MUTEX_INITIALIZER;
+static int lru_prev[NODES], lru_next[NODES], lru_mru, lru_lru;
+
+static void
+lru_add (int k)
+{
+  mutex_lock (&lru_lock);
+  if (lru_mru != k)
+    {
+      /* Unlink.  */
+      lru_next[lru_prev[k]] = lru_next[k];
+      if (lru_next[k] >= 0)
+	lru_prev[lru_next[k]] = lru_prev[k];
+      else
+	lru_lru = lru_prev[k];
+
+      /* Move to the front.  */
+      lru_prev[k] = -1;
+      lru_next[k] = lru_mru;
+      lru_prev[lru_mru] = k;
+      lru_mru = k;
+    }
+  mutex_unlock (&lru_lock);
+}
+
+static int lookups = 1000000;
+static int use_lru;
+
+static void *
+worker (void *arg)
+{
+  unsigned int state = (unsigned int) (long) arg * 2654435761U + 1;
+  int i;
+
+  for (i = 0; i < lookups; i++)
+    {
+      int k;
+
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+      k = state % NODES;
+
+      if (use_lru)
+	lru_add (k);
+      else
+	ncache_node_add (&nodes[k]);
+    }
+
+  return NULL;
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run THREADS threads and return the number of lookups per
+   second.  */
+static double
+run (int threads)
+{
+  pthread_t tids[threads];
+  double start;
+  int i;
+
+  start = now ();
+  for (i = 0; i < threads; i++)
+    pthread_create (&tids[i], NULL, worker, (void *) (long) i);
+  for (i = 0; i < threads; i++)
+    pthread_join (tids[i], NULL);
+
+  return (double) threads * lookups / (now () - start);
+}
+
+int
+main (int argc, char **argv)
+{
+  int threads_max = argc > 1 ? atoi (argv[1]) : 64;
+  int i;
+
+  if (argc > 2)
+    lookups = atoi (argv[2]);
+
+  ncache_init (NODES, 0);
+  for (i = 0; i < NODES; i++)
+    {
+      nodes[i].nn = &netnodes[i];
+      nodes[i].references = 1;
+      netnodes[i].lnode = &lnodes[i];
+      lnodes[i].path_hash = (i + 1) * 2654435761U;
+      lnodes[i].node = &nodes[i];
+      ncache_node_add (&nodes[i]);
+
+      lru_prev[i] = i - 1;
+      lru_next[i] = i + 1 < NODES ? i + 1 : -1;
+    }
+  lru_mru = 0;
+  lru_lru = NODES - 1;
+
+  printf ("%8s %16s %16s\n", "threads", "LRU lookups/s", "CAR lookups/s");
+  for (i = 1; i <= threads_max; i *= 2)
+    {
+      double lru, car;
+
+      use_lru = 1;
+      lru = run (i);
+      use_lru = 0;
+      car = run (i);
+      printf ("%8d %16.0f %16.0f\n", i, lru, car);
+    }
+
+  return 0;
+}
@@ -0,0 +1,459 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Replay traces of node lookups against the node cache and against
+   the LRU list unionfs used before, and report the hit ratios and the
+   time per lookup spent in the node cache, including creating and
+   freeing nodes on misses.  The cache is compiled from ncache.c on
+   the host, see shim/hurd/netfs.h.
+
+   Usage: ncache-replay [CACHE-SIZE [TRACE-FILE]]
+
+   Without TRACE-FILE, synthetic traces are replayed: Zipf distributed
+   lookups, the same interrupted by scans of the whole tree, and a loop
+   slightly larger than the cache.  A TRACE-FILE holds one path per
+   line, in the order they are looked up.  */
+
+#define _GNU_SOURCE
+
+#include "../ncache.c"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+int unionfs_flags;
+struct mutex debug_msg_lock = MUTEX_INITIALIZER;
+
+/* Nodes only live while they are referenced, as in libnetfs.  */
+void
+netfs_nref (struct node *node)
+{
+  node->references++;
+}
+
+void
+netfs_nrele (struct node *node)
+{
+  if (--node->references)
+    return;
+  node->nn->lnode->node = NULL;
+  free (node->nn);
+  free (node);
+}
+
+error_t
+node_create (lnode_t *lnode, node_t **node)
+{
+  node_t *n = calloc (1, sizeof (node_t));
+
+  if (! n)
+    return ENOMEM;
+  n->nn = calloc (1, sizeof (netnode_t));
+  if (! n->nn)
+    {
+      free (n);
+      return ENOMEM;
+    }
+  mutex_init (&n->lock);
+  n->references = 1;
+  n->nn->lnode = lnode;
+  n->nn->memory = sizeof (node_t) + sizeof (netnode_t);
+  lnode->node = n;
+  *node = n;
+  return 0;
+}
+
+/* The LRU list of the baseline, reduced to what decides hits.  */
+struct lru
+{
+  int *prev, *next;		/* Per key, -1 for none.  */
+  char *cached;
+  int mru, lru, num, size;
+};
+
+static void
+lru_init (struct lru *lru, int keys, int size)
+{
+  lru->prev = malloc (keys * sizeof (int));
+  lru->next = malloc (keys * sizeof (int));
+  lru->cached = calloc (keys, 1);
+  lru->mru = lru->lru = -1;
+  lru->num = 0;
+  lru->size = size;
+}
+
+static void
+lru_unlink (struct lru *lru, int k)
+{
+  if (lru->prev[k] >= 0)
+    lru->next[lru->prev[k]] = lru->next[k];
+  else
+    lru->mru = lru->next[k];
+  if (lru->next[k] >= 0)
+    lru->prev[lru->next[k]] = lru->prev[k];
+  else
+    lru->lru = lru->prev[k];
+}
+
+/* Look up K; return non-zero if it was cached.  */
+static int
+lru_lookup (struct lru *lru, int k)
+{
+  int hit = lru->cached[k];
+
+  if (hit)
+    lru_unlink (lru, k);
+  else
+    {
+      lru->cached[k] = 1;
+      lru->num++;
+    }
+
+  lru->prev[k] = -1;
+  lru->next[k] = lru->mru;
+  if (lru->mru >= 0)
+    lru->prev[lru->mru] = k;
+  else
+    lru->lru = k;
+  lru->mru = k;
+
+  if (lru->num > lru->size)
+    {
+      int victim = lru->lru;
+
+      lru_unlink (lru, victim);
+      lru->cached[victim] = 0;
+      lru->num--;
+    }
+
+  return hit;
+}
+
+static void
+lru_free (struct lru *lru)
+{
+  free (lru->prev);
+  free (lru->next);
+  free (lru->cached);
+}
+
+/* A trace: the keys of the looked up nodes.  */
+struct trace
+{
+  const char *name;
+  int *keys;
+  int num;
+  int keys_num;			/* Number of distinct keys.  */
+};
+
+static unsigned long long rand_state = 88172645463325252ULL;
+
+static unsigned int
+rand_next (void)
+{
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 7;
+  rand_state ^= rand_state << 17;
+  return rand_state >> 32;
+}
+
+/* Zipf distributed keys out of N with exponent S.  */
+struct zipf
+{
+  double *cdf;
+  int n;
+};
+
+static void
+zipf_init (struct zipf *z, int n, double s)
+{
+  double sum = 0;
+  int i;
+
+  z->cdf = malloc (n * sizeof (double));
+  z->n = n;
+  for (i = 0; i < n; i++)
+    z->cdf[i] = (sum += 1 / pow (i + 1, s));
+  for (i = 0; i < n; i++)
+    z->cdf[i] /= sum;
+}
+
+static int
+zipf_next (struct zipf *z)
+{
+  double u = rand_next () / 4294967296.0;
+  int lo = 0, hi = z->n - 1;
+
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (z->cdf[mid] < u)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static void
+trace_alloc (struct trace *t, const char *name, int num, int keys_num)
+{
+  t->name = name;
+  t->keys = malloc (num * sizeof (int));
+  t->num = num;
+  t->keys_num = keys_num;
+}
+
+/* Lookups of the hot part of a tree of 10 * SIZE nodes.  */
+static void
+trace_zipf (struct trace *t, int size)
+{
+  struct zipf z;
+  int i;
+
+  zipf_init (&z, 10 * size, 0.9);
+  trace_alloc (t, "zipf", 50 * size, 10 * size);
+  for (i = 0; i < t->num; i++)
+    t->keys[i] = zipf_next (&z);
+  free (z.cdf);
+}
+
+/* The same, interrupted by walks over the whole tree, e.g. by find or
+   a backup.  */
+static void
+trace_scan (struct trace *t, int size)
+{
+  int tree = 10 * size, i = 0;
+  struct zipf z;
+
+  zipf_init (&z, tree, 0.9);
+  trace_alloc (t, "zipf+scan", 60 * size, tree);
+  while (i < t->num)
+    {
+      int j;
+
+      for (j = 0; j < 4 * size && i < t->num; j++)
+	t->keys[i++] = zipf_next (&z);
+      for (j = 0; j < tree && i < t->num; j++)
+	t->keys[i++] = j;
+    }
+  free (z.cdf);
+}
+
+/* A loop over slightly more nodes than the cache holds.  */
+static void
+trace_loop (struct trace *t, int size)
+{
+  int n = size + size / 4, i;
+
+  trace_alloc (t, "loop", 50 * size, n);
+  for (i = 0; i < t->num; i++)
+    t->keys[i] = i % n;
+}
+
+/* Read the paths in FILE as a trace.  */
+static void
+trace_read (struct trace *t, const char *file)
+{
+  char **paths = NULL, *line = NULL;
+  int *table, table_size = 1 << 16, alloced = 0;
+  size_t line_size = 0;
+  ssize_t len;
+  FILE *f;
+
+  f = fopen (file, "r");
+  if (! f)
+    error (1, errno, "%s", file);
+
+  table = malloc (table_size * sizeof (int));
+  memset (table, -1, table_size * sizeof (int));
+  t->name = file;
+  t->keys = NULL;
+  t->num = t->keys_num = 0;
+
+  while ((len = getline (&line, &line_size, f)) > 0)
+    {
+      unsigned int slot;
+
+      if (line[len - 1] == '\n')
+	line[--len] = '\0';
+
+      if ((t->keys_num + 1) * 2 > table_size)
+	{
+	  int i;
+
+	  table_size *= 2;
+	  table = realloc (table, table_size * sizeof (int));
+	  memset (table, -1, table_size * sizeof (int));
+	  for (i = 0; i < t->keys_num; i++)
+	    {
+	      for (slot = name_hash (paths[i], NULL) & (table_size - 1);
+		   table[slot] >= 0;
+		   slot = (slot + 1) & (table_size - 1));
+	      table[slot] = i;
+	    }
+	}
+
+      for (slot = name_hash (line, NULL) & (table_size - 1);
+	   table[slot] >= 0 && strcmp (paths[table[slot]], line);
+	   slot = (slot + 1) & (table_size - 1));
+      if (table[slot] < 0)
+	{
+	  paths = realloc (paths, (t->keys_num + 1) * sizeof (char *));
+	  paths[t->keys_num] = strdup (line);
+	  table[slot] = t->keys_num++;
+	}
+
+      if (t->num == alloced)
+	{
+	  alloced = alloced ? 2 * alloced : 4096;
+	  t->keys = realloc (t->keys, alloced * sizeof (int));
+	}
+      t->keys[t->num++] = table[slot];
+    }
+
+  fclose (f);
+  free (line);
+  free (table);
+  for (len = 0; len < t->keys_num; len++)
+    free (paths[len]);
+  free (paths);
+}
+
+/* Hash values of the paths of the light nodes; the names of the
+   nodes do not matter.  */
+unsigned int
+name_hash (const char *name, size_t *len)
+{
+  unsigned int hash = 5381;
+  const char *p;
+
+  for (p = name; *p; p++)
+    hash = hash * 33 + (unsigned char) *p;
+  if (len)
+    *len = p - name;
+  return hash;
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Replay T against the node cache of SIZE nodes and the baseline LRU
+   list and print the results.  */
+static void
+replay (struct trace *t, int size)
+{
+  lnode_t *lnodes = calloc (t->keys_num, sizeof (lnode_t));
+  int hits = 0, lru_hits = 0, i;
+  struct lru lru;
+  double start, elapsed;
+
+  for (i = 0; i < t->keys_num; i++)
+    lnodes[i].path_hash = (i + 1) * 2654435761U;
+
+  memset (&ncache, 0, sizeof (ncache));
+  ncache_init (size, 0);
+
+  start = now ();
+  for (i = 0; i < t->num; i++)
+    {
+      lnode_t *lnode = &lnodes[t->keys[i]];
+      node_t *node;
+
+      if (lnode->node)
+	hits++;
+      if (ncache_node_lookup (lnode, &node))
+	error (1, ENOMEM, "node_create");
+      mutex_unlock (&node->lock);
+      ncache_node_add (node);
+      netfs_nrele (node);
+    }
+  elapsed = now () - start;
+
+  lru_init (&lru, t->keys_num, size);
+  for (i = 0; i < t->num; i++)
+    lru_hits += lru_lookup (&lru, t->keys[i]);
+
+  printf ("%-12s %8d %8d %10d %9.2f%% %9.2f%% %8.0f ns\n",
+	  t->name, size, t->keys_num, t->num,
+	  100.0 * lru_hits / t->num, 100.0 * hits / t->num,
+	  1e9 * elapsed / t->num);
+
+  /* Empty the cache.  */
+  while (ncache.size_current)
+    ncache_replace ();
+  for (i = 0; i < 2; i++)
+    {
+      free (ncache.ghost[i].entries);
+      free (ncache.ghost[i].buckets);
+    }
+  lru_free (&lru);
+  free (lnodes);
+}
+
+int
+main (int argc, char **argv)
+{
+  int size = argc > 1 ? atoi (argv[1]) : 0;
+  int sizes[] = { 256, 4096, 65536 }, sizes_num = 3;
+  int i, j;
+
+  printf ("%-12s %8s %8s %10s %10s %10s %11s\n",
+	  "trace", "cache", "nodes", "lookups", "LRU hits", "CAR hits",
+	  "CAR time");
+
+  if (argc > 2)
+    {
+      struct trace t;
+
+      trace_read (&t, argv[2]);
+      replay (&t, size > 0 ? size : NCACHE_SIZE);
+      free (t.keys);
+      return 0;
+    }
+
+  if (size > 0)
+    {
+      sizes[0] = size;
+      sizes_num = 1;
+    }
+
+  for (i = 0; i < sizes_num; i++)
+    {
+      void (*gen[]) (struct trace *, int) =
+	{ trace_zipf, trace_scan, trace_loop };
+
+      for (j = 0; j < 3; j++)
+	{
+	  struct trace t;
+
+	  gen[j] (&t, sizes[i]);
+	  replay (&t, sizes[i]);
+	  free (t.keys);
+	}
+    }
+
+  return 0;
+}
@@ -0,0 +1,177 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Match names against lists of --match patterns of increasing length,
+   once with patternlist_match and once with the baseline's loop
+   calling fnmatch for each pattern, check that both agree and report
+   the time per name.  pattern.c is compiled on the host, see
+   shim/hurd/netfs.h.
+
+   Usage: pattern-bench [NAMES]  */
+
+#define _GNU_SOURCE
+
+#include <hurd/netfs.h>
+#include <error.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pattern.h"
+
+/* The baseline's patternlist_match.  */
+static int
+baseline_match (struct patternlist *list, char *string)
+{
+  struct pattern *ptr;
+  int err = FNM_NOMATCH;
+
+  mutex_lock (&list->lock);
+  for (ptr = list->head; err && ptr; ptr = ptr->next)
+    err = fnmatch (ptr->pattern, string, FNM_FILE_NAME);
+  mutex_unlock (&list->lock);
+
+  return err;
+}
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Store the pattern number I of a list in BUF: package names, name
+   prefixes and wildcard patterns like the ones used with stow.  */
+static void
+make_pattern (char *buf, int i)
+{
+  switch (i % 4)
+    {
+    case 0:
+      sprintf (buf, "pkg%d", i);
+      break;
+    case 1:
+      sprintf (buf, "lib%d*", i);
+      break;
+    case 2:
+      sprintf (buf, "tool%d-*.[0-9]", i);
+      break;
+    default:
+      sprintf (buf, "*-extra%d", i);
+      break;
+    }
+}
+
+/* Store the name number I of a stow directory in BUF, matched by
+   some of the patterns.  */
+static void
+make_name (char *buf, int i, int patterns)
+{
+  int j = i % (2 * patterns);
+
+  switch (i % 5)
+    {
+    case 0:
+      sprintf (buf, "pkg%d", j);
+      break;
+    case 1:
+      sprintf (buf, "lib%d-%d", j, i);
+      break;
+    case 2:
+      sprintf (buf, "tool%d-%d.%d", j, i, i % 10);
+      break;
+    case 3:
+      sprintf (buf, "package-%d-extra%d", i, j);
+      break;
+    default:
+      sprintf (buf, "unrelated-%d", i);
+      break;
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  static const int sizes[] = { 1, 10, 100, 1000 };
+  int names_num = argc > 1 ? atoi (argv[1]) : 20000;
+  char **names = malloc (names_num * sizeof (char *));
+  int s, i, failed = 0;
+
+  printf ("%8s %12s %14s %14s %8s\n", "patterns", "add",
+	  "match before", "match now", "matched");
+
+  for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++)
+    {
+      struct patternlist list = { .lock = MUTEX_INITIALIZER };
+      int n = sizes[s], matched = 0, r;
+      double t0, t_add, t_before, t_now;
+      char buf[64];
+
+      for (i = 0; i < names_num; i++)
+	{
+	  make_name (buf, i, n);
+	  names[i] = strdup (buf);
+	}
+
+      t0 = now ();
+      for (i = 0; i < n; i++)
+	{
+	  make_pattern (buf, i);
+	  if (patternlist_add (&list, buf))
+	    error (1, ENOMEM, "patternlist_add");
+	}
+      t_add = now () - t0;
+
+      t0 = now ();
+      for (i = 0; i < names_num; i++)
+	r = baseline_match (&list, names[i]);
+      t_before = now () - t0;
+
+      t0 = now ();
+      for (i = 0; i < names_num; i++)
+	r = patternlist_match (&list, names[i]);
+      t_now = now () - t0;
+
+      for (i = 0; i < names_num; i++)
+	{
+	  r = ! patternlist_match (&list, names[i]);
+	  if (r != ! baseline_match (&list, names[i]))
+	    {
+	      printf ("FAIL: `%s' with %d patterns\n", names[i], n);
+	      failed = 1;
+	    }
+	  matched += r;
+	}
+
+      printf ("%8d %9.0f us %11.0f ns %11.0f ns %7.1f%%\n",
+	      n, 1e6 * t_add,
+	      1e9 * t_before / names_num, 1e9 * t_now / names_num,
+	      100.0 * matched / names_num);
+
+      patternlist_destroy (&list);
+      for (i = 0; i < names_num; i++)
+	free (names[i]);
+    }
+
+  free (names);
+  return failed;
+}
@@ -0,0 +1,187 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Read a directory with dir_readdir in chunks of several sizes, both
+   limited by the number of entries and by the size of the reply, and
+   check that every name of the complete listing is returned exactly
+   once.  Run it on a directory of a union mount which needs more than
+   one reply, e.g.:
+
+     $ settrans -a /tmp/u unionfs /usr/bin /bin
+     $ readdir-chunks /tmp/u  */
+
+#define _GNU_SOURCE
+
+#include <hurd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* A list of names read from a directory.  */
+struct names
+{
+  char **names;
+  int num, size;
+};
+
+static void
+names_add (struct names *names, const char *name, size_t len)
+{
+  if (names->num == names->size)
+    {
+      names->size = names->size ? names->size * 2 : 64;
+      names->names = realloc (names->names,
+			      names->size * sizeof (char *));
+      if (! names->names)
+	error (1, ENOMEM, "realloc");
+    }
+  names->names[names->num] = strndup (name, len);
+  if (! names->names[names->num])
+    error (1, ENOMEM, "strndup");
+  names->num++;
+}
+
+static void
+names_free (struct names *names)
+{
+  int i;
+
+  for (i = 0; i < names->num; i++)
+    free (names->names[i]);
+  free (names->names);
+  memset (names, 0, sizeof (*names));
+}
+
+static int
+names_compare (const void *a, const void *b)
+{
+  return strcmp (* (char * const *) a, * (char * const *) b);
+}
+
+/* Read all of DIR into NAMES, asking for at most NENTRIES entries
+   (-1 for no limit) and BUFSIZ bytes (0 for no limit) per request.
+   Return the number of requests needed.  */
+static int
+read_chunked (file_t dir, int nentries, vm_size_t bufsiz,
+	      struct names *names)
+{
+  char buf[2048];
+  int entry = 0, requests = 0;
+
+  for (;;)
+    {
+      char *data = buf, *p;
+      mach_msg_type_number_t data_len = sizeof (buf);
+      int amount, i;
+      error_t err;
+
+      err = dir_readdir (dir, &data, &data_len, entry, nentries,
+			 bufsiz, &amount);
+      if (err)
+	error (1, err, "dir_readdir");
+      requests++;
+
+      for (p = data, i = 0; i < amount; i++)
+	{
+	  struct dirent *dirent = (struct dirent *) p;
+
+	  if (p + dirent->d_reclen > data + data_len
+	      || dirent->d_reclen == 0)
+	    error (1, 0, "malformed reply at entry %d", entry + i);
+	  names_add (names, dirent->d_name, dirent->d_namlen);
+	  p += dirent->d_reclen;
+	}
+
+      if (data != buf)
+	munmap (data, data_len);
+
+      if (amount == 0)
+	break;
+      entry += amount;
+    }
+
+  return requests;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const int nentries[] = { 1, 2, 3, 7, 64, -1, -1, -1 };
+  static const vm_size_t bufsiz[] = { 0, 0, 0, 0, 0, 300, 1000, 4096 };
+  struct names all = { 0 };
+  file_t dir;
+  int i, j, failed = 0;
+
+  if (argc != 2)
+    error (1, 0, "Usage: %s DIRECTORY", argv[0]);
+
+  dir = file_name_lookup (argv[1], O_READ, 0);
+  if (dir == MACH_PORT_NULL)
+    error (1, errno, "%s", argv[1]);
+
+  read_chunked (dir, -1, 0, &all);
+  qsort (all.names, all.num, sizeof (char *), names_compare);
+  for (j = 1; j < all.num; j++)
+    if (! strcmp (all.names[j - 1], all.names[j]))
+      {
+	printf ("FAIL: `%s' listed more than once\n", all.names[j]);
+	failed = 1;
+      }
+
+  for (i = 0; i < sizeof (nentries) / sizeof (nentries[0]); i++)
+    {
+      struct names chunked = { 0 };
+      int requests;
+
+      requests = read_chunked (dir, nentries[i], bufsiz[i], &chunked);
+      qsort (chunked.names, chunked.num, sizeof (char *), names_compare);
+
+      if (chunked.num != all.num)
+	{
+	  printf ("FAIL: %d entries, %zu bytes per request: "
+		  "%d names instead of %d\n",
+		  nentries[i], (size_t) bufsiz[i], chunked.num, all.num);
+	  failed = 1;
+	}
+      else
+	for (j = 0; j < all.num; j++)
+	  if (strcmp (chunked.names[j], all.names[j]))
+	    {
+	      printf ("FAIL: %d entries, %zu bytes per request: "
+		      "`%s' instead of `%s'\n",
+		      nentries[i], (size_t) bufsiz[i],
+		      chunked.names[j], all.names[j]);
+	      failed = 1;
+	      break;
+	    }
+
+      printf ("%d entries, %zu bytes per request: %d names in %d requests\n",
+	      nentries[i], (size_t) bufsiz[i], chunked.num, requests);
+      names_free (&chunked);
+    }
+
+  names_free (&all);
+  mach_port_deallocate (mach_task_self (), dir);
+
+  return failed;
+}
@@ -0,0 +1,140 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Read a directory with dir_readdir in chunks of a fixed number of
+   entries and report the time per chunk as the first entry of the
+   chunks grows.  When seeking into the merged listing is cheap, the
+   time stays flat; when it walks the listing from its head, it grows
+   with the first entry.  Run it on a large directory of a union
+   mount, e.g.:
+
+     $ mkdir /tmp/a /tmp/b
+     $ cd /tmp/a && seq 50000 | xargs touch
+     $ settrans -a /tmp/u unionfs /tmp/a /tmp/b
+     $ readdir-seek /tmp/u 64
+
+   Usage: readdir-seek DIRECTORY [ENTRIES-PER-CHUNK [ROUNDS]]  */
+
+#define _GNU_SOURCE
+
+#include <hurd.h>
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+/* Number of rows printed for one pass over the directory.  */
+#define ROWS 10
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Read the NENTRIES entries of DIR starting at ENTRY and return the
+   number of entries returned.  */
+static int
+read_chunk (file_t dir, int entry, int nentries)
+{
+  char buf[2048], *data = buf;
+  mach_msg_type_number_t data_len = sizeof (buf);
+  int amount;
+  error_t err;
+
+  err = dir_readdir (dir, &data, &data_len, entry, nentries, 0, &amount);
+  if (err)
+    error (1, err, "dir_readdir");
+  if (data != buf)
+    munmap (data, data_len);
+
+  return amount;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nentries = argc > 2 ? atoi (argv[2]) : 64;
+  int rounds = argc > 3 ? atoi (argv[3]) : 5;
+  double *times, first = 0, last = 0;
+  int entries, chunks, i, r, row;
+  file_t dir;
+
+  if (argc < 2 || nentries <= 0 || rounds <= 0)
+    error (1, 0, "Usage: %s DIRECTORY [ENTRIES-PER-CHUNK [ROUNDS]]",
+	   argv[0]);
+
+  dir = file_name_lookup (argv[1], O_READ, 0);
+  if (dir == MACH_PORT_NULL)
+    error (1, errno, "%s", argv[1]);
+
+  /* Count the chunks; this also fills the cache of the listing.  */
+  for (entries = 0, chunks = 0;
+       (i = read_chunk (dir, entries, nentries)) > 0;
+       entries += i, chunks++);
+  if (chunks <= ROWS)
+    error (1, 0, "%s: only %d entries, too few to measure", argv[1],
+	   entries);
+
+  /* Time each chunk; the best of ROUNDS passes is kept.  The first
+     chunk also checks the underlying directories for changes and is
+     left out below.  */
+  times = malloc (chunks * sizeof (double));
+  if (! times)
+    error (1, ENOMEM, "malloc");
+  for (r = 0; r < rounds; r++)
+    for (i = 0; i < chunks; i++)
+      {
+	double start = now (), t;
+
+	read_chunk (dir, i * nentries, nentries);
+	t = now () - start;
+	if (r == 0 || t < times[i])
+	  times[i] = t;
+      }
+
+  printf ("%12s %14s\n", "first entry", "us per chunk");
+  for (row = 0; row < ROWS; row++)
+    {
+      int from = 1 + row * (chunks - 1) / ROWS;
+      int to = 1 + (row + 1) * (chunks - 1) / ROWS;
+      double sum = 0;
+
+      for (i = from; i < to; i++)
+	sum += times[i];
+      sum /= to - from;
+
+      if (row == 0)
+	first = sum;
+      last = sum;
+      printf ("%12d %14.1f\n", from * nentries, 1e6 * sum);
+    }
+  printf ("%d entries, %d per chunk: last/first %.2f\n",
+	  entries, nentries, last / first);
+
+  free (times);
+  mach_port_deallocate (mach_task_self (), dir);
+
+  return 0;
+}
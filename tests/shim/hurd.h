@@ -0,0 +1,2 @@
+/* See hurd/netfs.h.  */
+#include <hurd/netfs.h>
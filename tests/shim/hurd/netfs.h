@@ -0,0 +1,69 @@
+/* Hurd unionfs
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or * (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+   USA.  */
+
+/* Just enough of the Hurd interfaces for compiling the parts of
+   unionfs which do not talk to other servers, like the node cache,
+   on a POSIX host, for the benchmarks in this directory.  Nodes are
+   plain structures; the benchmarks provide netfs_nref, netfs_nrele
+   and node_create.  */
+
+#ifndef SHIM_HURD_NETFS_H
+#define SHIM_HURD_NETFS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+typedef unsigned int mach_port_t;
+typedef mach_port_t file_t;
+typedef int mach_msg_type_name_t;
+
+#define MACH_PORT_NULL 0
+#define mach_task_self() 0
+#define mach_port_deallocate(task, port) 0
+
+#define O_READ O_RDONLY
+
+/* cthreads, on top of POSIX threads.  */
+struct mutex
+{
+  pthread_mutex_t m;
+};
+#define MUTEX_INITIALIZER { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(l) pthread_mutex_init (&(l)->m, NULL)
+#define mutex_lock(l) pthread_mutex_lock (&(l)->m)
+#define mutex_unlock(l) pthread_mutex_unlock (&(l)->m)
+
+struct node
+{
+  struct netnode *nn;
+  struct mutex lock;
+  struct stat nn_stat;
+  int references;
+};
+
+void netfs_nref (struct node *node);
+void netfs_nrele (struct node *node);
+
+#endif
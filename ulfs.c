@@ -32,19 +32,25 @@
 #include "lib.h"
 #include "ulfs.h"
 
-/* The start of the ulfs chain.  */
-ulfs_t *ulfs_chain_start;
+/* The table used as long as no filesystem has been registered.  */
+static ulfs_table_t ulfs_table_empty;
 
-/* The end of the ulfs chain, we need this, to go through the chain in
-   reversed order.  */
-ulfs_t *ulfs_chain_end;
+/* The registered underlying filesystems, in priority order.  */
+ulfs_table_t *ulfs_table = &ulfs_table_empty;
 
 /* Number of registered underlying filesystems.  */
 unsigned int ulfs_num;
 
+/* Changed whenever an underlying filesystem is added or removed, so
+   that information referring to them by index can be dropped.  */
+unsigned int ulfs_gen;
+
 /* The lock protecting the ulfs data structures.  */
 struct mutex ulfs_lock = MUTEX_INITIALIZER;
 
+/* The ID of the last underlying filesystem registered.  */
+static unsigned int ulfs_id_last;
+
 /* Create a new ulfs element.  */
 static error_t
 ulfs_create (char *path, ulfs_t **ulfs)
@@ -66,9 +72,8 @@ ulfs_create (char *path, ulfs_t **ulfs)
       else
 	{
 	  ulfs_new->path = path_cp;
+	  ulfs_new->id = ++ulfs_id_last;
 	  ulfs_new->flags = 0;
-	  ulfs_new->next = NULL;
-	  ulfs_new->prev = NULL;
 	  *ulfs = ulfs_new;
 	}
     }
@@ -83,107 +88,141 @@ ulfs_destroy (ulfs_t *ulfs)
   free (ulfs);
 }
 
-/* Install ULFS into the linked list of registered filesystems in
- * priority order.  */
+/* Allocate a table for NUM filesystems and store it in *TABLE.  */
+static error_t
+ulfs_table_create (int num, ulfs_table_t **table)
+{
+  ulfs_table_t *table_new;
+
+  table_new = malloc (sizeof (ulfs_table_t) + num * sizeof (ulfs_t *));
+  if (! table_new)
+    return ENOMEM;
+
+  table_new->num = num;
+  *table = table_new;
+  return 0;
+}
+
+/* Replace the table of registered filesystems with TABLE.  The
+   ulfs_lock must be held by the caller.  */
 static void
-ulfs_install (ulfs_t *ulfs)
+ulfs_table_set (ulfs_table_t *table)
 {
-  ulfs_t *u = ulfs_chain_start;
-  int insert_at_end = 0;
-  if (ulfs_num == 0)
-    {
-      ulfs_chain_start = ulfs;
-      return;
-    }
+  if (ulfs_table != &ulfs_table_empty)
+    free (ulfs_table);
 
-  /* walk the chain until a filesystem has a priority that's too high. */
-  while (u->priority > ulfs->priority)
-    {
-      if (u->next == NULL)
-	{
-	  insert_at_end = 1;
-	  break;
-	}
-      u = u->next;
-    }
+  ulfs_table = table;
+  ulfs_num = table->num;
+  ulfs_gen++;
+}
 
-  if (insert_at_end)
-    {
-      u->next = ulfs;
-      ulfs->prev = u;
-    }
-  else
+/* Return the index at which a filesystem with PRIORITY is to be
+   inserted; it goes before all filesystems with the same or a lower
+   priority.  */
+static int
+ulfs_table_position (int priority)
+{
+  int low = 0, high = ulfs_table->num;
+
+  while (low < high)
     {
-      if (u == ulfs_chain_start)
-	{
-	  ulfs_chain_start = ulfs;
-	  ulfs->next = u;
-	  ulfs->prev = NULL;
-	  u->prev = ulfs;
-	}
+      int mid = (low + high) / 2;
+
+      if (ulfs_table->ulfs[mid]->priority > priority)
+	low = mid + 1;
       else
-	{
-	  ulfs->next = u;
-	  ulfs->prev = u->prev;
-	  u->prev->next = ulfs;
-	  u->prev = ulfs;
-	}
+	high = mid;
     }
 
-  return;
+  return low;
 }
 
-/* Remove ULFS from the linked list of registered filesystems.  */
-static void
-ulfs_uninstall (ulfs_t *ulfs)
+/* Install the NUM filesystems in ULFS, which must all have the same
+   priority, into the table of registered filesystems in priority
+   order, just like installing them one after the other would.  This
+   copies the whole table, so that registering L filesystems one at a
+   time takes O(L^2); filesystems are registered rarely and mostly in
+   batches through ulfs_register_many, which copies the table once.  */
+static error_t
+ulfs_install (ulfs_t **ulfs, int num)
 {
-  if (ulfs == ulfs_chain_start)
-      ulfs_chain_start = ulfs->next;
-
-  if (ulfs->next)
-    ulfs->next->prev = ulfs->prev;
+  ulfs_table_t *table;
+  error_t err;
+  int i, j;
+
+  err = ulfs_table_create (ulfs_table->num + num, &table);
+  if (err)
+    return err;
+
+  i = ulfs_table_position (ulfs[0]->priority);
+  memcpy (table->ulfs, ulfs_table->ulfs, i * sizeof (ulfs_t *));
+  /* Each filesystem goes before the ones installed earlier.  */
+  for (j = 0; j < num; j++)
+    table->ulfs[i + j] = ulfs[num - 1 - j];
+  memcpy (table->ulfs + i + num, ulfs_table->ulfs + i,
+	  (ulfs_table->num - i) * sizeof (ulfs_t *));
+
+  ulfs_table_set (table);
+  return 0;
+}
 
-  if (ulfs->prev)
-    ulfs->prev->next = ulfs->next;
+/* Remove the filesystems at the NUM indices in the increasing list
+   INDICES from the table of registered filesystems and destroy
+   them.  */
+static error_t
+ulfs_uninstall (int *indices, int num)
+{
+  ulfs_table_t *table;
+  error_t err;
+  int i, j = 0, k = 0;
+
+  err = ulfs_table_create (ulfs_table->num - num, &table);
+  if (err)
+    return err;
+
+  for (i = 0; i < ulfs_table->num; i++)
+    if (j < num && indices[j] == i)
+      {
+	ulfs_destroy (ulfs_table->ulfs[i]);
+	j++;
+      }
+    else
+      table->ulfs[k++] = ulfs_table->ulfs[i];
+
+  ulfs_table_set (table);
+  return 0;
 }
 
 /* Get an ulfs element by it's index.  */
 error_t
 ulfs_get_num (int num, ulfs_t **ulfs)
 {
-  error_t err = EINVAL;
-  ulfs_t *u;
-  int i;
-
-  for (u = ulfs_chain_start, i = 0;
-       u && i < num;
-       u = u->next, i++);
-  if (u)
-    {
-      err = 0;
-      *ulfs = u;
-    }
+  if (num < 0 || num >= ulfs_table->num)
+    return EINVAL;
 
-  return err;
+  *ulfs = ulfs_table->ulfs[num];
+  return 0;
 }
 
-/* Get an ulfs element by the associated path.  */
+/* Get the index of the ulfs element associated with PATH.  */
 static error_t
-ulfs_get_path (char *path, ulfs_t **ulfs)
+ulfs_get_path (char *path, int *num)
 {
-  error_t err = ENOENT;
-  ulfs_t *u;
-
-  for (u = ulfs_chain_start;
-       u && (! (((! path) && path == u->path)
-		|| (path && u->path && (! strcmp (path, u->path)))));
-       u = u->next);
-  if (u)
+  int i;
+
+  for (i = 0; i < ulfs_table->num; i++)
     {
-      err = 0;
-      *ulfs = u;
+      ulfs_t *u = ulfs_table->ulfs[i];
+
+      if (((! path) && path == u->path)
+	  || (path && u->path && (! strcmp (path, u->path))))
+	{
+	  *num = i;
+	  return 0;
+	}
     }
-  return err;
+
+  return ENOENT;
 }
 
 error_t
@@ -192,13 +231,14 @@ ulfs_for_each_under_priv (char *path_under,
 			  void *priv)
 {
   error_t err = 0;
-  ulfs_t *u;
   size_t length;
   
   length = strlen (path_under);
 
-  for (u = ulfs_chain_start; u; u = u->next)
+  ulfs_iterate_unlocked
     {
+      ulfs_t *u = ulfs;
+
       if (!u->path)
 	continue;
 
@@ -232,89 +272,135 @@ ulfs_register (char *path, int flags, int priority)
     {
       ulfs->flags = flags;
       ulfs->priority = priority;
-      ulfs_install (ulfs);
-      ulfs_num++;
+      err = ulfs_install (&ulfs, 1);
+      if (err)
+	ulfs_destroy (ulfs);
+    }
+  mutex_unlock (&ulfs_lock);
+  return err;
+}
+
+/* Register the NUM underlying filesystems in PATHS at once, which
+   must all be directories.  The result is the same as registering
+   them one after the other.  */
+error_t
+ulfs_register_many (char **paths, int num, int flags, int priority)
+{
+  ulfs_t **ulfs;
+  error_t err = 0;
+  int i;
+
+  if (! num)
+    return 0;
+
+  ulfs = malloc (num * sizeof (ulfs_t *));
+  if (! ulfs)
+    return ENOMEM;
+
+  mutex_lock (&ulfs_lock);
+  for (i = 0; i < num; i++)
+    {
+      err = ulfs_create (paths[i], ulfs + i);
+      if (err)
+	break;
+      ulfs[i]->flags = flags;
+      ulfs[i]->priority = priority;
     }
+
+  if (! err)
+    err = ulfs_install (ulfs, num);
+  if (err)
+    while (i--)
+      ulfs_destroy (ulfs[i]);
   mutex_unlock (&ulfs_lock);
+
+  free (ulfs);
   return err;
 }
 
 /* Check for deleted ulfs entries.  */
-/* FIXME: Ugly as hell. Rewrite the whole ulfs.c  */
-void
+error_t
 ulfs_check ()
 {
-  ulfs_t *u;
+  int *indices;
+  int i, num = 0;
+  error_t err = 0;
   file_t p;
 
-  struct ulfs_destroy
-  {
-    ulfs_t *ulfs;
-
-    struct ulfs_destroy *next;
-  } *ulfs_destroy_q = NULL;
-
   mutex_lock (&ulfs_lock);
 
-  u = ulfs_chain_start;
-  while (u)
+  indices = malloc (ulfs_table->num * sizeof (int));
+  if (ulfs_table->num && ! indices)
+    err = ENOMEM;
+
+  for (i = 0; ! err && i < ulfs_table->num; i++)
     {
-      
+      ulfs_t *u = ulfs_table->ulfs[i];
+
       if (u->path)
 	p = file_name_lookup (u->path, O_READ | O_DIRECTORY, 0);
       else
 	p = underlying_node;
 	  
       if (! port_valid (p))
-	{
-	  struct ulfs_destroy *ptr;
-
-	  /* Add to destroy list.  */
-	  ptr = malloc (sizeof (struct ulfs_destroy));
-	  assert (ptr);
-
-	  ptr->ulfs = u;
-
-	  ptr->next = ulfs_destroy_q;
-	  ulfs_destroy_q = ptr;
-	}
-	  
-      u = u->next;
+	indices[num++] = i;
+      else if (p != underlying_node)
+	port_dealloc (p);
     }
 
-  while (ulfs_destroy_q)
-    {
-      struct ulfs_destroy *ptr;
-
-      ptr = ulfs_destroy_q;
-      ulfs_destroy_q = ptr->next;
-
-      ulfs_uninstall (ptr->ulfs);
-      ulfs_destroy (ptr->ulfs);
-      ulfs_num--;	  
-
-      free (ptr);
-    }
+  if (! err && num)
+    err = ulfs_uninstall (indices, num);
 
+  free (indices);
   mutex_unlock (&ulfs_lock);
 
+  return err;
 }
 
 /* Unregister an underlying filesystem.  */
 error_t
 ulfs_unregister (char *path)
 {
-  ulfs_t *ulfs;
   error_t err;
+  int i;
 
   mutex_lock (&ulfs_lock);
-  err = ulfs_get_path (path, &ulfs);
+  err = ulfs_get_path (path, &i);
   if (! err)
+    err = ulfs_uninstall (&i, 1);
+  mutex_unlock (&ulfs_lock);
+
+  return err;
+}
+
+/* Unregister all underlying filesystems whose path starts with
+   PREFIX.  */
+error_t
+ulfs_unregister_under (char *prefix)
+{
+  size_t length = strlen (prefix);
+  int *indices;
+  error_t err = 0;
+  int i, num = 0;
+
+  mutex_lock (&ulfs_lock);
+
+  indices = malloc (ulfs_table->num * sizeof (int));
+  if (ulfs_table->num && ! indices)
+    err = ENOMEM;
+
+  for (i = 0; ! err && i < ulfs_table->num; i++)
     {
-      ulfs_uninstall (ulfs);
-      ulfs_destroy (ulfs);
-      ulfs_num--;
+      ulfs_t *u = ulfs_table->ulfs[i];
+
+      if (u->path && ! strncmp (u->path, prefix, length))
+	indices[num++] = i;
     }
+
+  if (! err)
+    err = num ? ulfs_uninstall (indices, num) : ENOENT;
+
+  free (indices);
   mutex_unlock (&ulfs_lock);
 
   return err;
@@ -26,50 +26,75 @@
 typedef struct ulfs
 {
   char *path;
+  unsigned int id;		/* Unique among all underlying
+				   filesystems ever registered, never
+				   zero.  */
   int flags;
   int priority;
-  struct ulfs *next, *prev;
 } ulfs_t;
 
+/* A table of registered underlying filesystems, ordered by
+   decreasing priority, so that the filesystem at an index is found in
+   constant time.  Adding or removing a filesystem copies the table in
+   O(L) for L filesystems, installs the copy and frees the old table
+   right away, so the table must only be used with ulfs_lock held.  */
+typedef struct ulfs_table
+{
+  int num;			/* Number of entries in ULFS.  */
+  ulfs_t *ulfs[];
+} ulfs_table_t;
+
 /* Flags.  */
 
 /* The according ulfs is marked writable.  */
 #define FLAG_ULFS_WRITABLE 0x00000001
 
-/* The start of the ulfs chain.  */
-extern ulfs_t *ulfs_chain_start;
-
-/* The end of the ulfs chain, we need this, to go through the chain in
-   reversed order.  */
-extern ulfs_t *ulfs_chain_end;
+/* The registered underlying filesystems, in priority order.  */
+extern ulfs_table_t *ulfs_table;
 
 /* Number of registered underlying filesystems.  */
 extern unsigned int ulfs_num;
 
+/* Changed whenever an underlying filesystem is added or removed, so
+   that information referring to them by index can be dropped.  */
+extern unsigned int ulfs_gen;
+
 /* The lock protecting the ulfs data structures.  */
 extern struct mutex ulfs_lock;
 
 /* Register a new underlying filesystem.  */
 error_t ulfs_register (char *path, int flags, int priority);
 
+/* Register the NUM underlying filesystems in PATHS at once, which
+   must all be directories.  The result is the same as registering
+   them one after the other.  */
+error_t ulfs_register_many (char **paths, int num, int flags, int priority);
+
 /* Unregister an underlying filesystem.  */
 error_t ulfs_unregister (char *path);
 
+/* Unregister all underlying filesystems whose path starts with
+   PREFIX.  */
+error_t ulfs_unregister_under (char *prefix);
+
 /* Get an ULFS element by it's index.  */
 error_t ulfs_get_num (int num, ulfs_t **ulfs);
 
 /* Removes invalid ulfs entries.  */
-void ulfs_check (void);
-
-#define ulfs_iterate                             \
-  for (ulfs_t *ulfs = (mutex_lock (&ulfs_lock),  \
-		       ulfs_chain_start);          \
-       ulfs || (mutex_unlock (&ulfs_lock), 0);   \
-       ulfs = ulfs->next) 
-
-#define ulfs_iterate_unlocked                    \
-  for (ulfs_t *ulfs = ulfs_chain_start;            \
-       ulfs;                                     \
-       ulfs = ulfs->next)
+error_t ulfs_check (void);
+
+#define ulfs_iterate                                          \
+  for (ulfs_t **ulfsp = (mutex_lock (&ulfs_lock),             \
+			 ulfs_table->ulfs), *ulfs;            \
+       (ulfsp < ulfs_table->ulfs + ulfs_table->num            \
+	&& (ulfs = *ulfsp, 1))                                \
+	 || (mutex_unlock (&ulfs_lock), 0);                   \
+       ulfsp++)
+
+#define ulfs_iterate_unlocked                                 \
+  for (ulfs_t **ulfsp = ulfs_table->ulfs, *ulfs;              \
+       ulfsp < ulfs_table->ulfs + ulfs_table->num             \
+	 && (ulfs = *ulfsp, 1);                               \
+       ulfsp++)
 
 #endif
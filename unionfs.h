@@ -53,6 +53,62 @@
 /* Default maximum number of nodes in the cache.  */
 #define NCACHE_SIZE 256
 
+/* Default maximum number of bytes used by the nodes in the cache.  */
+#define NCACHE_MEMORY (16 * 1024 * 1024)
+
+/* Default maximum number of bytes read from an underlying directory
+   at once.  */
+#define READDIR_CHUNK_SIZE (64 * 1024)
+
+/* Default number of seconds the information cached about the
+   entries of a directory is used without checking the underlying
+   directories.  With zero, the underlying directories are checked on
+   every lookup, so that changes made to them directly are always
+   seen.  */
+#define CACHE_TIMEOUT 0
+
+/* Default number of seconds the ports to the underlying directories
+   of a node are used without looking them up again.  They are looked
+   up for almost every operation on the node, so these lookups are
+   not repeated on each of them.  */
+#define PORT_TIMEOUT 1
+
+/* Maximum number of looked up names cached per directory; must be a
+   power of two.  */
+#define NAME_CACHE_SIZE 128
+
+/* The hash table of the entries of a light node starts with
+   2^LNODE_ENTRIES_BITS buckets and doubles whenever an entry is added
+   to a bucket already holding LNODE_ENTRIES_CHAIN entries, up to
+   2^LNODE_ENTRIES_BITS_MAX buckets.  */
+#define LNODE_ENTRIES_BITS 3
+#define LNODE_ENTRIES_BITS_MAX 20
+#define LNODE_ENTRIES_CHAIN 2
+
+/* Number of locks shared by the entries of all light nodes; must be a
+   power of two.  */
+#define LNODE_LOCKS 64
+
+/* Initial number of hash buckets for the interned names, in all
+   shards together; must be a power of two.  */
+#define NAMES_SIZE 1024
+
+/* Number of separately locked tables the interned names are spread
+   over; must be a power of two.  */
+#define NAMES_SHARDS 16
+
+/* Default number of threads issuing requests to the underlying
+   filesystems in parallel.  */
+#define POOL_THREADS 8
+
+/* Default number of milliseconds to wait for further changes of the
+   underlying filesystems before updating the root node.  */
+#define UPDATE_DELAY 100
+
+/* Default maximum number of milliseconds an update of the root node
+   is postponed by further changes.  */
+#define UPDATE_DELAY_MAX 1000
+
 /* The inode for the root node.  */
 #define UNIONFS_ROOT_INODE 1
 
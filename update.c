@@ -24,54 +24,155 @@
 
 #include <errno.h>
 #include <string.h>
+#include <sys/time.h>
 #include <cthreads.h>
 #include <rwlock.h>
 
-#include "ncache.h"
+#include "unionfs.h"
 #include "node.h"
 #include "ulfs.h"
+#include "update.h"
 
 /* Reader lock is used by threads that are going to
    add/remove an ulfs; writer lock is hold by the 
    update thread.  */
 static struct rwlock update_rwlock;
-static struct condition update_wakeup;
 static struct mutex update_lock;
 
+/* A message is sent to this port whenever an update is requested.
+   cthreads offers no condition wait with a timeout, so the update
+   thread waits for the next request by receiving from the port, with
+   a timeout if needed.  At most one message is queued.  */
+static mach_port_t update_port;
+
+/* Number of milliseconds to wait for further changes before updating
+   the root node, may be overwritten by the user.  */
+int update_delay = UPDATE_DELAY;
+
+/* Maximum number of milliseconds an update is postponed by further
+   changes, may be overwritten by the user.  */
+int update_delay_max = UPDATE_DELAY_MAX;
+
+/* Number of updates requested and number of updates performed; the
+   difference is the number of requests coalesced with others.  Both
+   are protected by UPDATE_LOCK and reported in debug mode.  */
+static unsigned long update_requests;
+static unsigned long update_runs;
+
+/* Number of updates requested since the last update started,
+   protected by UPDATE_LOCK.  */
+static int update_pending;
+
+/* Wait until an update is requested, but not longer than MSECS
+   milliseconds unless MSECS is negative.  The update_lock must be
+   held by the caller; it is released while waiting.  Return non-zero
+   if the wait timed out.  */
+static int
+update_wait (int msecs)
+{
+  mach_msg_header_t msg;
+  error_t err;
+
+  mutex_unlock (&update_lock);
+  err = mach_msg (&msg, MACH_RCV_MSG | (msecs >= 0 ? MACH_RCV_TIMEOUT : 0),
+		  0, sizeof (msg), update_port,
+		  msecs >= 0 ? msecs : MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL);
+  mutex_lock (&update_lock);
+
+  return err == MACH_RCV_TIMED_OUT;
+}
+
 static void
 _root_update_thread ()
 {
   error_t err;
+  struct timeval start, now;
+  int coalesced, waited, delay;
+  unsigned long requests, runs;
   
+  mutex_lock (&update_lock);
   while (1)
     {
-      if (hurd_condition_wait (&update_wakeup, &update_lock))
-	mutex_unlock (&update_lock);
+      while (! update_pending)
+	update_wait (-1);
+
+      /* Wait until no change has been requested for UPDATE_DELAY
+	 milliseconds, but not longer than UPDATE_DELAY_MAX in total,
+	 so that all changes are applied in one update.  */
+      gettimeofday (&start, NULL);
+      while (1)
+	{
+	  gettimeofday (&now, NULL);
+	  waited = ((now.tv_sec - start.tv_sec) * 1000
+		    + (now.tv_usec - start.tv_usec) / 1000);
+
+	  delay = update_delay;
+	  if (delay > update_delay_max - waited)
+	    delay = update_delay_max - waited;
+	  if (delay <= 0 || update_wait (delay))
+	    break;
+	}
+
+      coalesced = update_pending;
+      update_pending = 0;
+      requests = update_requests;
+      runs = ++update_runs;
+      mutex_unlock (&update_lock);
+
+      debug_msg ("root update for %d requests (%lu updates for %lu"
+		 " requests so far)", coalesced, runs, requests);
 
       rwlock_writer_lock (&update_rwlock);
 
-      do 
+      /* Only filesystems which have been registered since the last
+	 update are opened; if one of them has vanished or is no
+	 directory, all of them are checked.  */
+      err = node_init_root (netfs_root_node);
+      while (err == ENOENT || err == ENOTDIR)
 	{
-	  ulfs_check();
+	  unsigned int gen = ulfs_gen;
+	  error_t check_err = ulfs_check ();
+
+	  if (check_err)
+	    err = check_err;
+	  if (check_err || ulfs_gen == gen)
+	    /* Nothing could be removed; trying again would fail the
+	       same way.  */
+	    break;
+
 	  err = node_init_root (netfs_root_node);
 	}
-      while (err == ENOENT);
 
       if (err)
 	{
 	  fprintf (stderr, "update thread: got a %s\n", strerror (err));
 	}
 
-      ncache_reset ();
-
       rwlock_writer_unlock (&update_rwlock);
+
+      mutex_lock (&update_lock);
     }
 }
 
 void
 root_update_schedule ()
 {
-  condition_signal (&update_wakeup);
+  mach_msg_header_t msg;
+
+  mutex_lock (&update_lock);
+  update_pending++;
+  update_requests++;
+  mutex_unlock (&update_lock);
+
+  /* Wake up the update thread; if a message is queued already, it
+     is woken up anyway.  */
+  msg.msgh_bits = MACH_MSGH_BITS (MACH_MSG_TYPE_COPY_SEND, 0);
+  msg.msgh_size = sizeof (msg);
+  msg.msgh_remote_port = update_port;
+  msg.msgh_local_port = MACH_PORT_NULL;
+  msg.msgh_id = 0;
+  mach_msg (&msg, MACH_SEND_MSG | MACH_SEND_TIMEOUT, sizeof (msg), 0,
+	    MACH_PORT_NULL, 0, MACH_PORT_NULL);
 }
 
 void
@@ -86,12 +187,24 @@ root_update_enable ()
   rwlock_reader_unlock (&update_rwlock);
 }
 
-void
+error_t
 root_update_init()
 {
+  error_t err;
+
   mutex_init (&update_lock);
   rwlock_init (&update_rwlock);
-  condition_init (&update_wakeup);
+
+  err = mach_port_allocate (mach_task_self (), MACH_PORT_RIGHT_RECEIVE,
+			    &update_port);
+  if (! err)
+    err = mach_port_insert_right (mach_task_self (), update_port,
+				  update_port, MACH_MSG_TYPE_MAKE_SEND);
+  if (! err)
+    err = mach_port_set_qlimit (mach_task_self (), update_port, 1);
+  if (err)
+    return err;
 
   cthread_detach (cthread_fork ( (cthread_fn_t)_root_update_thread, 0));
+  return 0;
 }
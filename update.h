@@ -20,9 +20,17 @@
 #ifndef _UDPATE_H
 #define _UPDATE_H
 
+/* Number of milliseconds to wait for further changes before updating
+   the root node, may be overwritten by the user.  */
+extern int update_delay;
+
+/* Maximum number of milliseconds an update is postponed by further
+   changes, may be overwritten by the user.  */
+extern int update_delay_max;
+
 void root_update_schedule ();
 void root_update_disable ();
 void root_update_enable ();
-void root_update_init ();
+error_t root_update_init ();
 
 #endif /* UPDATE_H */